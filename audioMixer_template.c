@@ -1,61 +1,194 @@
 // Note: Generates low latency audio on BeagleBone Black; higher latency found on host.
 #include "audioMixer_template.h"
-#include <alsa/asoundlib.h>
+#include "triggerBus.h"
+#include "threadManager.h"
+#include "mixPool.h"
+#include "recorder.h"
+#include "audioOutput.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
 #include <pthread.h>
 #include <limits.h>
-#include <alloca.h> // needed for mixer
-
-
-static snd_pcm_t *handle;
+#include <time.h>
 
 #define DEFAULT_VOLUME 80
 
 #define SAMPLE_RATE 44100
-#define NUM_CHANNELS 1
+#define NUM_CHANNELS 2
 #define SAMPLE_SIZE (sizeof(short)) 			
 static unsigned long playbackBufferSize = 0;
 static short *playbackBuffer = NULL;
-#define MAX_SOUND_BITES 30
+#define MAX_SOUND_BITES 256
+// Voice gains are Q15 (32768 = unity). The read cursor is location plus a
+// 16-bit fraction advanced by step per output frame, so any pitch plays
+// with linear interpolation between neighbouring samples.
+#define Q15_ONE 32768
+#define CURSOR_FRACTION_BITS 16
+#define UNITY_STEP (1 << CURSOR_FRACTION_BITS)
+// The envelope level is kept in Q30 so slow decays still move every frame.
+#define ENVELOPE_ONE (1 << 30)
+#define ENVELOPE_TO_Q15 15
 typedef struct {
 	wavedata_t *pSound;
 	int location;
+	uint32_t fraction;
+	uint32_t step;
+	int32_t gain;
+	int32_t panLeft;
+	int32_t panRight;
+	int32_t envelope;
+	int32_t envelopeStep;	// subtracted every frame, 0 for no decay
+	bool finished;			// set while mixing, slot freed under audioMutex after
 } playbackSound_t;
 static playbackSound_t soundBites[MAX_SOUND_BITES];
+// Samples the trigger bus can refer to by id.
+static wavedata_t *sampleTable[AUDIOMIXER_MAX_SAMPLES];
+static unsigned long droppedTriggers = 0;
 void* playbackThread(void* arg);
-static bool stopping = false;
+static atomic_bool stopping = false;
 static pthread_t playbackThreadId;
 static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
 static int volume = 0;
+// Offline mode renders periods on request without ALSA or a playback thread.
+static bool offline = false;
+// Output frames mixed since the recording started; triggers are logged
+// against it so a replay starts each voice in the same period.
+static uint64_t framesMixed = 0;
+static bool recording = false;
+static int loggedGainPercent = -1;
+// Written by the playback thread each period, read by AudioMixer_getStats().
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static audioMixerStats_t stats;
+
+// Voices are summed into 32-bit buses without clamping; the result only
+// passes through master gain and the limiter once, in the output stage.
+// In parallel mode every mix pool part has its own bus, added into bus 0.
+// The active voices are listed under audioMutex at the top of each period
+// and mixed without it: other threads only ever claim free slots, so they
+// never touch a listed voice, and each part owns a contiguous run of them.
+static int numMixWorkers = 1;
+static int32_t *mixBuses[MIXPOOL_MAX_PARTS];
+static int activeVoices[MAX_SOUND_BITES];
+static int numActiveVoices = 0;
+static int mixFrames = 0;
+static void mixPart(int part, int numParts);
+static void fillPlaybackBuffer(short *buff, int size);
+static void freeMixState(void);
+
+// Master gain is applied in 1/256ths ahead of the limiter.
+#define GAIN_SHIFT 8
+#define UNITY_GAIN (1 << GAIN_SHIFT)
+static atomic_int masterGainPercent = 100;
+// Samples below the threshold pass untouched; above it the limiter bends
+// them smoothly towards full scale instead of hard clipping.
+#define LIMITER_THRESHOLD 24576
+#define LIMITER_RANGE (SHRT_MAX - LIMITER_THRESHOLD)
+// Bus values are clamped here before gain so the product fits in 32 bits;
+// the limiter output is already within one step of full scale by then.
+#define BUS_HEADROOM (1 << 20)
+
+void AudioMixer_setMixWorkers(int numWorkers)
+{
+	if (numWorkers < 1 || numWorkers > MIXPOOL_MAX_PARTS) {
+		LOG_ERROR("Mix workers must be between 1 and %d.", MIXPOOL_MAX_PARTS);
+		return;
+	}
+	numMixWorkers = numWorkers;
+}
 
-void AudioMixer_init(void)
+// Voices, buses and the mix pool; shared by live and offline mode.
+static void initMixState(void)
 {
-	AudioMixer_setVolume(DEFAULT_VOLUME);
 	for(int i = 0; i < MAX_SOUND_BITES; i++){
 		soundBites[i].pSound = NULL;
 	}
-	int err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
-	if (err < 0) {
-		printf("Playback open error: %s\n", snd_strerror(err));
-		exit(EXIT_FAILURE);
+	framesMixed = 0;
+	playbackBuffer = malloc(playbackBufferSize * NUM_CHANNELS * sizeof(*playbackBuffer));
+	for (int i = 0; i < numMixWorkers; i++) {
+		mixBuses[i] = malloc(playbackBufferSize * NUM_CHANNELS * sizeof(*mixBuses[i]));
+	}
+	if (numMixWorkers > 1 && !MixPool_init(numMixWorkers, mixPart)) {
+		LOG_WARN("Falling back to serial mixing");
+		for (int i = 1; i < numMixWorkers; i++) {
+			free(mixBuses[i]);
+			mixBuses[i] = NULL;
+		}
+		numMixWorkers = 1;
 	}
-	err = snd_pcm_set_params(handle,
-			SND_PCM_FORMAT_S16_LE,
-			SND_PCM_ACCESS_RW_INTERLEAVED,
-			NUM_CHANNELS,
-			SAMPLE_RATE,
-			1,			// Allow software resampling
-			50000);		// 0.05 seconds per buffer
-	if (err < 0) {
-		printf("Playback open error: %s\n", snd_strerror(err));
+}
+
+void AudioMixer_init(void)
+{
+	offline = false;
+	atomic_store(&stopping, false);
+	AudioMixer_setVolume(DEFAULT_VOLUME);
+	if (!AudioOutput_open(SAMPLE_RATE, NUM_CHANNELS, &playbackBufferSize)) {
 		exit(EXIT_FAILURE);
 	}
- 	unsigned long unusedBufferSize = 0;
-	snd_pcm_get_params(handle, &unusedBufferSize, &playbackBufferSize);
-	playbackBuffer = malloc(playbackBufferSize * sizeof(*playbackBuffer));
+	initMixState();
+	pthread_mutex_lock(&statsMutex);
+	memset(&stats, 0, sizeof(stats));
+	stats.periodNs = (uint64_t) playbackBufferSize * 1000000000ULL / SAMPLE_RATE;
+	pthread_mutex_unlock(&statsMutex);
 	pthread_create(&playbackThreadId, NULL, playbackThread, NULL);
 }
 
+void AudioMixer_initOffline(int periodFrames)
+{
+	offline = true;
+	playbackBufferSize = periodFrames;
+	initMixState();
+}
+
+void AudioMixer_renderPeriod(short *pBuffer)
+{
+	fillPlaybackBuffer(pBuffer, playbackBufferSize);
+}
+
+int AudioMixer_getNumChannels(void)
+{
+	return NUM_CHANNELS;
+}
+
+int AudioMixer_getSampleRate(void)
+{
+	return SAMPLE_RATE;
+}
+
+int AudioMixer_getPeriodFrames(void)
+{
+	return playbackBufferSize;
+}
+
+void AudioMixer_getStats(audioMixerStats_t *pStats)
+{
+	pthread_mutex_lock(&statsMutex);
+	*pStats = stats;
+	pthread_mutex_unlock(&statsMutex);
+}
+
+bool AudioMixer_startRecording(const char *wavPath, const char *logPath)
+{
+	// Files, buffers and the writer thread are set up before taking
+	// audioMutex, which the playback thread needs every period; only
+	// switching the tee on happens under it.
+	if (!Recorder_start(wavPath, logPath, SAMPLE_RATE, NUM_CHANNELS, playbackBufferSize)) {
+		return false;
+	}
+	pthread_mutex_lock(&audioMutex);
+	recording = true;
+	framesMixed = 0;
+	loggedGainPercent = -1;
+	pthread_mutex_unlock(&audioMutex);
+	return true;
+}
+
 void AudioMixer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound)
 {
 	assert(pSound);
@@ -90,170 +223,402 @@ void AudioMixer_freeWaveFileData(wavedata_t *pSound)
 	pSound->pData = NULL;
 }
 
-void AudioMixer_queueSound(wavedata_t *pSound)
+// Balance law: centre leaves both channels at full level, panning away
+// from a side fades that side out, so centred voices sound as they did in mono.
+static void getPanGains(int pan, int32_t *pLeft, int32_t *pRight)
 {
-	assert(pSound->numSamples > 0);
-	assert(pSound->pData);
-	int full = 1;
-	int insertingIndex = 0;
-
-	pthread_mutex_lock(&audioMutex);
+	int32_t left = (TRIGGERBUS_MAX_PAN - pan) * Q15_ONE / (TRIGGERBUS_MAX_PAN - TRIGGERBUS_CENTER_PAN);
+	int32_t right = pan * Q15_ONE / TRIGGERBUS_CENTER_PAN;
+	*pLeft = left > Q15_ONE ? Q15_ONE : left;
+	*pRight = right > Q15_ONE ? Q15_ONE : right;
+}
 
+// Claim a free voice for pSound. audioMutex must be held.
+static bool startVoice(wavedata_t *pSound, int velocity, const triggerParams_t *pParams)
+{
 	for(int i = 0; i < MAX_SOUND_BITES; i++){
 		if(soundBites[i].pSound == NULL){
-			full = 0;
-			insertingIndex = i;
-			i = MAX_SOUND_BITES;
+			playbackSound_t *voice = &soundBites[i];
+			voice->pSound = pSound;
+			voice->location = 0;
+			voice->fraction = 0;
+			voice->step = pParams->pitch * (UNITY_STEP / TRIGGERBUS_UNITY_PITCH);
+			voice->gain = velocity * Q15_ONE / TRIGGERBUS_MAX_VELOCITY;
+			getPanGains(pParams->pan, &voice->panLeft, &voice->panRight);
+			voice->envelope = ENVELOPE_ONE;
+			voice->envelopeStep = 0;
+			voice->finished = false;
+			if(pParams->decayMs > 0){
+				// 64-bit: a decay of a minute is already past INT_MAX / SAMPLE_RATE.
+				int decayFrames = (int64_t) pParams->decayMs * SAMPLE_RATE / 1000;
+				voice->envelopeStep = ENVELOPE_ONE / decayFrames + 1;
+			}
+			return true;
 		}
 	}
+	return false;
+}
 
-	if(full == 0){
-		soundBites[insertingIndex].pSound = pSound;
+void AudioMixer_queueSound(wavedata_t *pSound)
+{
+	assert(pSound->numSamples > 0);
+	assert(pSound->pData);
+
+	const triggerParams_t params = {
+		.pan = TRIGGERBUS_CENTER_PAN,
+		.pitch = TRIGGERBUS_UNITY_PITCH,
+		.decayMs = 0,
+	};
+	pthread_mutex_lock(&audioMutex);
+	bool queued = startVoice(pSound, TRIGGERBUS_MAX_VELOCITY, &params);
+	pthread_mutex_unlock(&audioMutex);
+
+	if(!queued){
+		LOG_LIMITED(LOG_LEVEL_WARN, 1,
+				"AudioMixer_queueSound error -- soundBites buffer of %d is full!",
+				MAX_SOUND_BITES);
 	}
+}
 
+void AudioMixer_registerSample(int sampleId, wavedata_t *pSound)
+{
+	assert(sampleId >= 0 && sampleId < AUDIOMIXER_MAX_SAMPLES);
+	pthread_mutex_lock(&audioMutex);
+	sampleTable[sampleId] = pSound;
 	pthread_mutex_unlock(&audioMutex);
+}
 
-	if(full == 1){
-		printf("AudioMixer_queueSound error -- soundBites buffer is full!\n");
-		printf("Buffer is sized %d\n", MAX_SOUND_BITES);
+// Turn every pending trigger into a voice. audioMutex must be held.
+// Runs on the playback thread, so failures are counted rather than printed.
+static void drainTriggerBus(void)
+{
+	triggerEvent_t event;
+	while(TriggerBus_pop(&event)){
+		wavedata_t *pSound = NULL;
+		if(event.sampleId < AUDIOMIXER_MAX_SAMPLES){
+			pSound = sampleTable[event.sampleId];
+		}
+		if(recording){
+			Recorder_logTrigger(framesMixed, &event);
+		}
+		if(pSound == NULL || !startVoice(pSound, event.velocity, &event.params)){
+			droppedTriggers++;
+		}
+	}
+}
 
-		for(int i = 0; i < MAX_SOUND_BITES; i++){
-			printf("soundBites %d is at location %d of indices %d\n",i,soundBites[i].location,soundBites[i].pSound->numSamples);
+static bool hasActiveVoices(void)
+{
+	bool active = false;
+	pthread_mutex_lock(&audioMutex);
+	for(int i = 0; i < MAX_SOUND_BITES; i++){
+		if(soundBites[i].pSound != NULL){
+			active = true;
 		}
 	}
+	pthread_mutex_unlock(&audioMutex);
+	return active;
 }
 
 void AudioMixer_cleanup(void)
 {
-	printf("Stopping audio...\n");
-	stopping = true;
+	if (offline) {
+		freeMixState();
+		return;
+	}
+	LOG_INFO("Stopping audio...");
+	// Let sounds already playing ring out, but never hold up shutdown for long.
+	const struct timespec pollDelay = {0, 10 * 1000 * 1000};
+	for(int waitedMs = 0; waitedMs < AUDIOMIXER_DRAIN_TIMEOUT_MS && hasActiveVoices(); waitedMs += 10){
+		nanosleep(&pollDelay, NULL);
+	}
+	atomic_store(&stopping, true);
 	pthread_join(playbackThreadId, NULL);
-	snd_pcm_drain(handle);
-	snd_pcm_close(handle);
+	AudioOutput_close();
+	freeMixState();
+	unsigned long overflows = 0;
+	for(int source = 0; source < TRIGGER_SOURCE_COUNT; source++){
+		overflows += TriggerBus_getOverflowCount(source);
+	}
+	LOG_INFO("Triggers posted %lu, lost to a full bus %lu, dropped by mixer %lu",
+			TriggerBus_getPostedCount(), overflows, droppedTriggers);
+	LOG_INFO("Done stopping audio...");
+}
+
+static void freeMixState(void)
+{
+	if (recording) {
+		Recorder_stop();
+		recording = false;
+	}
 	free(playbackBuffer);
 	playbackBuffer = NULL;
-	printf("Done stopping audio...\n");
-	fflush(stdout);
+	if (numMixWorkers > 1) {
+		MixPool_cleanup();
+	}
+	for (int i = 0; i < numMixWorkers; i++) {
+		free(mixBuses[i]);
+		mixBuses[i] = NULL;
+	}
 }
 
 
+void AudioMixer_setMasterGain(int gainPercent)
+{
+	if (gainPercent < 0 || gainPercent > AUDIOMIXER_MAX_MASTER_GAIN) {
+		LOG_ERROR("Master gain must be between 0 and %d.", AUDIOMIXER_MAX_MASTER_GAIN);
+		return;
+	}
+	atomic_store(&masterGainPercent, gainPercent);
+}
+
 int AudioMixer_getVolume()
 {
 	return volume;
 }
 
-// Function copied from:
-// http://stackoverflow.com/questions/6787318/set-alsa-master-volume-from-c-code
-// Written by user "trenki".
 void AudioMixer_setVolume(int newVolume)
 {
 	if (newVolume < 0 || newVolume > AUDIOMIXER_MAX_VOLUME) {
-		printf("ERROR: Volume must be between 0 and 100.\n");
+		LOG_ERROR("Volume must be between 0 and 100.");
 		return;
 	}
 	volume = newVolume;
-    long min, max;
-    snd_mixer_t *volHandle;
-    snd_mixer_selem_id_t *sid;
-    const char *card = "default";
-    const char *selem_name = "PCM";
-    snd_mixer_open(&volHandle, 0);
-    snd_mixer_attach(volHandle, card);
-    snd_mixer_selem_register(volHandle, NULL, NULL);
-    snd_mixer_load(volHandle);
-    snd_mixer_selem_id_alloca(&sid);
-    snd_mixer_selem_id_set_index(sid, 0);
-    snd_mixer_selem_id_set_name(sid, selem_name);
-    snd_mixer_elem_t* elem = snd_mixer_find_selem(volHandle, sid);
-    snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-    snd_mixer_selem_set_playback_volume_all(elem, volume * max / 100);
-    snd_mixer_close(volHandle);
+	AudioOutput_setVolume(volume);
 }
 
 
-static void fillPlaybackBuffer(short *buff, int size)
+// The slot stays claimed until releaseFinishedVoices() runs under audioMutex.
+static void retireVoice(playbackSound_t *voice)
 {
-	for(int i = 0; i < size; i++){
-		playbackBuffer[i] = 0;
+	voice->finished = true;
+}
+
+// Original pitch and no envelope: a straight copy at constant stereo gain,
+// simple enough for the compiler to vectorize.
+static void mixVoiceUnity(int32_t *restrict bus, playbackSound_t *voice, int size)
+{
+	int remaining = voice->pSound->numSamples - voice->location;
+	int end = remaining > size ? size : remaining;
+	const short *restrict data = voice->pSound->pData + voice->location;
+	int32_t gainLeft = voice->gain * voice->panLeft >> 15;
+	int32_t gainRight = voice->gain * voice->panRight >> 15;
+	for(int j = 0; j < end; j++){
+		bus[2 * j] += data[j] * gainLeft >> 15;
+		bus[2 * j + 1] += data[j] * gainRight >> 15;
+	}
+	voice->location += end;
+	if(voice->location == voice->pSound->numSamples){
+		retireVoice(voice);
 	}
+}
+
+// Any pitch and envelope: fractional cursor with linear interpolation and
+// a linear decay of the voice gain, all in integer arithmetic.
+static void mixVoiceGeneral(int32_t *restrict bus, playbackSound_t *voice, int size)
+{
+	const short *data = voice->pSound->pData;
+	int numSamples = voice->pSound->numSamples;
+	int location = voice->location;
+	uint32_t fraction = voice->fraction;
+	int32_t envelope = voice->envelope;
+	for(int j = 0; j < size; j++){
+		if(location >= numSamples || envelope <= 0){
+			retireVoice(voice);
+			return;
+		}
+		int32_t current = data[location];
+		int32_t next = location + 1 < numSamples ? data[location + 1] : current;
+		// Drop one fraction bit so the difference times the fraction fits in 32 bits.
+		int32_t sample = current
+				+ (((next - current) * (int32_t) (fraction >> 1)) >> (CURSOR_FRACTION_BITS - 1));
+		int32_t gain = voice->gain * (envelope >> ENVELOPE_TO_Q15) >> 15;
+		int32_t value = sample * gain >> 15;
+		bus[2 * j] += value * voice->panLeft >> 15;
+		bus[2 * j + 1] += value * voice->panRight >> 15;
+
+		fraction += voice->step;
+		location += fraction >> CURSOR_FRACTION_BITS;
+		fraction &= UNITY_STEP - 1;
+		envelope -= voice->envelopeStep;
+	}
+	voice->location = location;
+	voice->fraction = fraction;
+	voice->envelope = envelope;
+	if(location >= numSamples || envelope <= 0){
+		retireVoice(voice);
+	}
+}
+
+// Add one voice's next size frames into an interleaved stereo 32-bit bus and
+// retire the voice when it ends. Each voice is only ever touched by one part.
+static void mixVoiceIntoBus(int32_t *bus, playbackSound_t *voice, int size)
+{
+	if(voice->step == UNITY_STEP && voice->envelopeStep == 0){
+		mixVoiceUnity(bus, voice, size);
+	} else{
+		mixVoiceGeneral(bus, voice, size);
+	}
+}
+
+// Runs on the playback thread (part 0) and the mix pool workers.
+static void mixPart(int part, int numParts)
+{
+	int32_t *bus = mixBuses[part];
+	memset(bus, 0, mixFrames * NUM_CHANNELS * sizeof(*bus));
+	// A contiguous share per part keeps each core on its own voice structs.
+	int first = numActiveVoices * part / numParts;
+	int last = numActiveVoices * (part + 1) / numParts;
+	for(int k = first; k < last; k++){
+		mixVoiceIntoBus(bus, &soundBites[activeVoices[k]], mixFrames);
+	}
+}
+
+// Soft knee above the threshold: y = T + R*e / (e + R) where e is how far
+// the input is past T. Slope is 1 at the threshold and y never reaches
+// full scale, so dense passages compress instead of clipping.
+static short limitSample(int32_t x)
+{
+	int32_t magnitude = x < 0 ? -x : x;
+	if (magnitude <= LIMITER_THRESHOLD) {
+		return x;
+	}
+	int64_t excess = magnitude - LIMITER_THRESHOLD;
+	int32_t limited = LIMITER_THRESHOLD
+			+ (int32_t) (LIMITER_RANGE * excess / (excess + LIMITER_RANGE));
+	return x < 0 ? -limited : limited;
+}
+
+// Output stage: master gain, limiter and conversion to S16_LE, once per
+// output sample. The gain and plain-narrowing loops are kept free of
+// branches and aliasing so the compiler can vectorize them (NEON on the
+// BeagleBone); only periods that actually reach the knee take the
+// per-sample limiter path.
+static void writeOutputStage(int32_t *restrict bus, short *restrict out, int size,
+		int gainPercent)
+{
+	int32_t gain = gainPercent * UNITY_GAIN / 100;
+	int32_t peak = 0;
+	for (int j = 0; j < size; j++) {
+		int32_t x = bus[j];
+		x = x > BUS_HEADROOM ? BUS_HEADROOM : x;
+		x = x < -BUS_HEADROOM ? -BUS_HEADROOM : x;
+		x = (x * gain) >> GAIN_SHIFT;
+		bus[j] = x;
+		int32_t magnitude = x < 0 ? -x : x;
+		peak = magnitude > peak ? magnitude : peak;
+	}
+
+	if (peak <= LIMITER_THRESHOLD) {
+		for (int j = 0; j < size; j++) {
+			out[j] = bus[j];
+		}
+	} else {
+		for (int j = 0; j < size; j++) {
+			out[j] = limitSample(bus[j]);
+		}
+	}
+}
+
+// Free the slots of voices that ended while mixing. audioMutex must be held.
+static void releaseFinishedVoices(void)
+{
+	for(int k = 0; k < numActiveVoices; k++){
+		playbackSound_t *voice = &soundBites[activeVoices[k]];
+		if(voice->finished){
+			voice->location = 0;
+			voice->pSound = NULL;
+		}
+	}
+}
+
+static void fillPlaybackBuffer(short *buff, int size)
+{
 	pthread_mutex_lock(&audioMutex);
-	int playbackBufferIterator = 0;
-	int end = 0;
-	short bufferVal = 0;
-	short soundByteVal = 0;
-	short insertingVal = 0;
-	int locationIterator = 0;
+	drainTriggerBus();
+	numActiveVoices = 0;
 	for(int i = 0; i < MAX_SOUND_BITES; i++){
 		if(soundBites[i].pSound != NULL){
-			locationIterator = soundBites[i].location;
-			if(soundBites[i].pSound->numSamples - locationIterator > size){
-				end = size;
-			}
-			else{
-				end = soundBites[i].pSound->numSamples - locationIterator;
-			}
-			for(int j = 0; j < end; j++){
-				bufferVal = playbackBuffer[playbackBufferIterator];
-				soundByteVal = soundBites[i].pSound->pData[locationIterator];	
-
-				if((bufferVal + soundByteVal) > SHRT_MAX){
-					insertingVal = SHRT_MAX;
-				} else if((bufferVal + soundByteVal) < SHRT_MIN){
-					insertingVal = SHRT_MIN;
-				} else{
-					insertingVal = bufferVal + soundByteVal;
-				}
-				playbackBuffer[playbackBufferIterator] = insertingVal;
-				playbackBufferIterator++;
-				soundBites[i].location++;
-				locationIterator++;
-			}
-			playbackBufferIterator = 0;
-			insertingVal = 0;
-			if((soundBites[i].location) == soundBites[i].pSound->numSamples){
-				soundBites[i].location = 0;
-				soundBites[i].pSound = NULL;
+			activeVoices[numActiveVoices++] = i;
+		}
+	}
+	int gainPercent = atomic_load_explicit(&masterGainPercent, memory_order_relaxed);
+	bool recordPeriod = recording;
+	if(recordPeriod && gainPercent != loggedGainPercent){
+		Recorder_logMasterGain(framesMixed, gainPercent);
+		loggedGainPercent = gainPercent;
+	}
+	framesMixed += size;
+	pthread_mutex_unlock(&audioMutex);
+
+	mixFrames = size;
+	if(numMixWorkers > 1){
+		MixPool_run();
+		// Integer addition, so the result does not depend on how voices were split.
+		for(int part = 1; part < numMixWorkers; part++){
+			for(int j = 0; j < size * NUM_CHANNELS; j++){
+				mixBuses[0][j] += mixBuses[part][j];
 			}
 		}
+	} else{
+		mixPart(0, 1);
 	}
+	pthread_mutex_lock(&audioMutex);
+	releaseFinishedVoices();
 	pthread_mutex_unlock(&audioMutex);
+
+	writeOutputStage(mixBuses[0], buff, size * NUM_CHANNELS, gainPercent);
+	if(recordPeriod){
+		Recorder_writePeriod(buff, size);
+	}
+}
+
+static uint64_t nowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Mix time and period-to-period jitter, measured at the top of each period.
+static void updateStats(uint64_t periodStartNs, uint64_t mixDoneNs, uint64_t *pLastStartNs)
+{
+	pthread_mutex_lock(&statsMutex);
+	uint64_t mixNs = mixDoneNs - periodStartNs;
+	stats.periods++;
+	stats.mixNsTotal += mixNs;
+	if (mixNs > stats.mixNsMax) {
+		stats.mixNsMax = mixNs;
+	}
+	if (*pLastStartNs != 0) {
+		uint64_t interval = periodStartNs - *pLastStartNs;
+		uint64_t jitter = interval > stats.periodNs
+				? interval - stats.periodNs : stats.periodNs - interval;
+		stats.jitterNsTotal += jitter;
+		if (jitter > stats.jitterNsMax) {
+			stats.jitterNsMax = jitter;
+		}
+	}
+	*pLastStartNs = periodStartNs;
+	pthread_mutex_unlock(&statsMutex);
 }
 
 void* playbackThread(void* arg)
 {
-	while (!stopping) {
+	ThreadManager_configureCurrentThread("audio-mix", THREAD_ROLE_AUDIO);
+	uint64_t lastStartNs = 0;
+	while (!atomic_load(&stopping)) {
+		uint64_t periodStartNs = nowNs();
 		fillPlaybackBuffer(playbackBuffer, playbackBufferSize);
-		snd_pcm_sframes_t frames = snd_pcm_writei(handle,
-				playbackBuffer, playbackBufferSize);
+		updateStats(periodStartNs, nowNs(), &lastStartNs);
+		long frames = AudioOutput_write(playbackBuffer, playbackBufferSize);
 		if (frames < 0) {
-			fprintf(stderr, "AudioMixer: writei() returned %li\n", frames);
-			frames = snd_pcm_recover(handle, frames, 1);
-		}
-		if (frames < 0) {
-			fprintf(stderr, "ERROR: Failed writing audio with snd_pcm_writei(): %li\n",
-					frames);
 			exit(EXIT_FAILURE);
 		}
-		if (frames > 0 && frames < playbackBufferSize) {
-			printf("Short write (expected %li, wrote %li)\n",
+		if (frames > 0 && frames < (long) playbackBufferSize) {
+			LOG_LIMITED(LOG_LEVEL_WARN, 1, "Short write (expected %li, wrote %li)",
 					playbackBufferSize, frames);
 		}
 	}
 	return NULL;
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -1,20 +1,59 @@
 // Playback sounds in real time, allowing multiple simultaneous wave files
-// to be mixed together and played without jitter.
+// to be mixed together and played without jitter. Output is interleaved
+// stereo; each voice has its own pan, pitch and decay (see triggerParams_t).
 #ifndef AUDIO_MIXER_H
 #define AUDIO_MIXER_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef struct {
 	int numSamples;
 	short *pData;
 } wavedata_t;
 
 #define AUDIOMIXER_MAX_VOLUME 100
+#define AUDIOMIXER_MAX_SAMPLES 32
+#define AUDIOMIXER_MAX_MASTER_GAIN 400
+// On cleanup, playing voices get this long to finish before output stops.
+#define AUDIOMIXER_DRAIN_TIMEOUT_MS 300
+
+// Split mixing of each period across this many threads (1 = serial, the
+// default). Only worth it with many voices on a multi-core host; must be
+// called before init().
+void AudioMixer_setMixWorkers(int numWorkers);
 
 // init() must be called before any other functions,
 // cleanup() must be called last to stop playback threads and free memory.
 void AudioMixer_init(void);
 void AudioMixer_cleanup(void);
 
+// Offline mode: no audio device and no playback thread; each call to
+// renderPeriod() mixes the next periodFrames frames into pBuffer, which
+// holds periodFrames * getNumChannels() samples. Used to replay recorded
+// sessions. cleanup() ends offline mode too.
+void AudioMixer_initOffline(int periodFrames);
+void AudioMixer_renderPeriod(short *pBuffer);
+int  AudioMixer_getNumChannels(void);
+int  AudioMixer_getSampleRate(void);
+int  AudioMixer_getPeriodFrames(void);
+
+// Timing of the live playback thread since init(). Jitter is how far the
+// start of each period strayed from the nominal period length.
+typedef struct {
+	uint64_t periods;
+	uint64_t periodNs;		// nominal period length
+	uint64_t mixNsTotal;
+	uint64_t mixNsMax;
+	uint64_t jitterNsTotal;
+	uint64_t jitterNsMax;
+} audioMixerStats_t;
+void AudioMixer_getStats(audioMixerStats_t *pStats);
+
+// Record the mixed output and trigger log until cleanup(). Start before
+// any sound plays for the log to replay bit-exactly.
+bool AudioMixer_startRecording(const char *wavPath, const char *logPath);
+
 // Read the contents of a wave file into the pSound structure. Note that
 // the pData pointer in this structure will be dynamically allocated in
 // readWaveFileIntoMemory(), and is freed by calling freeWaveFileData().
@@ -24,10 +63,16 @@ void AudioMixer_freeWaveFileData(wavedata_t *pSound);
 // Queue up another sound bite to play as soon as possible.
 void AudioMixer_queueSound(wavedata_t *pSound);
 
-// Get/set the volume.
-// setVolume() function posted by StackOverflow user "trenki" at:
-// http://stackoverflow.com/questions/6787318/set-alsa-master-volume-from-c-code
+// Make pSound playable by trigger events posted with this sample id.
+// The mixer drains the trigger bus itself at the start of every period.
+void AudioMixer_registerSample(int sampleId, wavedata_t *pSound);
+
+// Get/set the volume of the audio output device (see audioOutput.h).
 int  AudioMixer_getVolume(void);
 void AudioMixer_setVolume(int newVolume);
 
+// Digital gain (percent, 100 = unity) applied to the mix before the output
+// limiter. Independent of the device volume above.
+void AudioMixer_setMasterGain(int gainPercent);
+
 #endif
@@ -0,0 +1,24 @@
+// Audio device the mixer plays through. audioOutputAlsa.c drives the
+// board's sound card; audioOutputNull.c discards the audio at the pace of a
+// real device so the engine can run headless on a host. Exactly one of the
+// two is linked into a build.
+#ifndef AUDIO_OUTPUT_H
+#define AUDIO_OUTPUT_H
+
+#include <stdbool.h>
+
+// Open the device for interleaved S16_LE output. On success *pPeriodFrames
+// is the number of frames the mixer should render per write.
+bool AudioOutput_open(int sampleRate, int numChannels, unsigned long *pPeriodFrames);
+
+// Play one period, blocking until the device has room for it. Returns the
+// number of frames written, or a negative value on an unrecoverable error.
+long AudioOutput_write(const short *pBuffer, unsigned long frames);
+
+// Wait for queued audio to finish playing, then release the device.
+void AudioOutput_close(void);
+
+// Hardware volume, 0 - 100.
+void AudioOutput_setVolume(int volume);
+
+#endif
@@ -0,0 +1,73 @@
+// ALSA playback and mixer volume for the BeagleBone's audio cape.
+#include "audioOutput.h"
+#include "logger.h"
+#include <alsa/asoundlib.h>
+#include <alloca.h> // needed for mixer
+
+static snd_pcm_t *handle;
+
+bool AudioOutput_open(int sampleRate, int numChannels, unsigned long *pPeriodFrames)
+{
+	int err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0) {
+		printf("Playback open error: %s\n", snd_strerror(err));
+		return false;
+	}
+	err = snd_pcm_set_params(handle,
+			SND_PCM_FORMAT_S16_LE,
+			SND_PCM_ACCESS_RW_INTERLEAVED,
+			numChannels,
+			sampleRate,
+			1,			// Allow software resampling
+			50000);		// 0.05 seconds per buffer
+	if (err < 0) {
+		printf("Playback open error: %s\n", snd_strerror(err));
+		return false;
+	}
+ 	unsigned long unusedBufferSize = 0;
+	snd_pcm_get_params(handle, &unusedBufferSize, pPeriodFrames);
+	return true;
+}
+
+long AudioOutput_write(const short *pBuffer, unsigned long frames)
+{
+	snd_pcm_sframes_t written = snd_pcm_writei(handle, pBuffer, frames);
+	if (written < 0) {
+		LOG_LIMITED(LOG_LEVEL_WARN, 1, "AudioMixer: writei() returned %li", written);
+		written = snd_pcm_recover(handle, written, 1);
+	}
+	if (written < 0) {
+		fprintf(stderr, "ERROR: Failed writing audio with snd_pcm_writei(): %li\n",
+				written);
+	}
+	return written;
+}
+
+void AudioOutput_close(void)
+{
+	snd_pcm_drain(handle);
+	snd_pcm_close(handle);
+}
+
+// Function copied from:
+// http://stackoverflow.com/questions/6787318/set-alsa-master-volume-from-c-code
+// Written by user "trenki".
+void AudioOutput_setVolume(int volume)
+{
+    long min, max;
+    snd_mixer_t *volHandle;
+    snd_mixer_selem_id_t *sid;
+    const char *card = "default";
+    const char *selem_name = "PCM";
+    snd_mixer_open(&volHandle, 0);
+    snd_mixer_attach(volHandle, card);
+    snd_mixer_selem_register(volHandle, NULL, NULL);
+    snd_mixer_load(volHandle);
+    snd_mixer_selem_id_alloca(&sid);
+    snd_mixer_selem_id_set_index(sid, 0);
+    snd_mixer_selem_id_set_name(sid, selem_name);
+    snd_mixer_elem_t* elem = snd_mixer_find_selem(volHandle, sid);
+    snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
+    snd_mixer_selem_set_playback_volume_all(elem, volume * max / 100);
+    snd_mixer_close(volHandle);
+}
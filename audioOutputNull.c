@@ -0,0 +1,53 @@
+// Null audio sink for host builds: accepts each period and sleeps until the
+// time a real device would have consumed it, so the playback thread keeps
+// its real-time cadence without any sound hardware.
+#include "audioOutput.h"
+#include <time.h>
+
+// Same order of period as ALSA picks for the BeagleBone's 50 ms buffer.
+#define NULL_PERIOD_FRAMES 512
+#define NS_PER_SECOND 1000000000LL
+
+static long long periodNs = 0;
+static struct timespec nextDeadline;
+
+static void addNs(struct timespec *pTime, long long ns)
+{
+	long long total = pTime->tv_nsec + ns;
+	pTime->tv_sec += total / NS_PER_SECOND;
+	pTime->tv_nsec = total % NS_PER_SECOND;
+}
+
+bool AudioOutput_open(int sampleRate, int numChannels, unsigned long *pPeriodFrames)
+{
+	(void) numChannels;
+	*pPeriodFrames = NULL_PERIOD_FRAMES;
+	periodNs = NULL_PERIOD_FRAMES * NS_PER_SECOND / sampleRate;
+	clock_gettime(CLOCK_MONOTONIC, &nextDeadline);
+	return true;
+}
+
+long AudioOutput_write(const short *pBuffer, unsigned long frames)
+{
+	(void) pBuffer;
+	addNs(&nextDeadline, periodNs * (long long) frames / NULL_PERIOD_FRAMES);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	// Like an underrun on a real device: fell behind, so restart the clock.
+	if (now.tv_sec > nextDeadline.tv_sec
+			|| (now.tv_sec == nextDeadline.tv_sec && now.tv_nsec > nextDeadline.tv_nsec)) {
+		nextDeadline = now;
+	} else {
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nextDeadline, NULL);
+	}
+	return frames;
+}
+
+void AudioOutput_close(void)
+{
+}
+
+void AudioOutput_setVolume(int volume)
+{
+	(void) volume;
+}
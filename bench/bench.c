@@ -0,0 +1,1096 @@
+// Host benchmark suite for the beatbox engine. Drives the mixer, WAV
+// loader, trigger bus, UDP server and thread lifecycle headlessly (null
+// audio sink, simulated sensors) and writes one JSON result per line.
+// Suites also check correctness (delivery, ordering, shutdown time and the
+// like); the run exits non-zero if any check fails.
+//
+//   beatbox-bench [--out FILE] [--quick] [--wav-dir DIR] [--scratch DIR] [SUITE...]
+//
+// Suites: wav mixer output decay bus burst recorder udp lifecycle jitter logging (default: all).
+// Inputs are generated from fixed seeds so runs are comparable.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "benchUtil.h"
+#include "../audioMixer_template.h"
+#include "../triggerBus.h"
+#include "../threadManager.h"
+#include "../schedProfile.h"
+#include "../functions.h"
+#include "../logger.h"
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#define BENCH_SEED 0x5eedbeefu
+#define BENCH_PERIOD_FRAMES 512
+#define BENCH_SAMPLE_RATE 44100
+#define BENCH_MAX_WAV_FILES 32
+// The UDP server listens on a fixed port, see networkCommunication().
+#define BENCH_UDP_PORT 12345
+#define NS_PER_MS 1000000ULL
+// Every thread is woken on shutdown, so joining them should take no longer
+// than a scheduling delay or two, far inside the lifecycle manager's timeout.
+#define BENCH_MAX_JOIN_MS 100
+// Live playback must deliver at least this share of the periods the sound
+// card consumed while it ran.
+#define BENCH_MIN_PACE_PCT 90
+// Logging under load may cost the mixer no more than this over the same
+// run with logging filtered out: a share of the baseline plus a fixed
+// allowance for scheduling noise.
+#define BENCH_LOG_MAX_COST_PCT 50
+#define BENCH_LOG_MIX_SLACK_US 20
+#define BENCH_LOG_JITTER_SLACK_US 1000
+#define NS_PER_US 1000ULL
+
+// Sample ids used by the offline mixer benchmarks.
+#define QUIET_SAMPLE_ID 0
+#define LOUD_SAMPLE_ID 1
+#define CONSTANT_SAMPLE_ID 2
+#define QUIET_AMPLITUDE 1000
+#define LOUD_AMPLITUDE 20000
+
+typedef enum {
+	FEATURE_UNITY,
+	FEATURE_PAN,
+	FEATURE_PITCH,
+	FEATURE_DECAY,
+	FEATURE_ALL,
+	FEATURE_COUNT
+} voiceFeature_t;
+
+static const char *featureNames[FEATURE_COUNT] = {
+	"unity", "pan", "pitch", "decay", "all",
+};
+
+static bool quick = false;
+static const char *wavDir = "beatbox-wave-files";
+static const char *scratchDir = "/tmp";
+static wavedata_t quietSample;
+static wavedata_t loudSample;
+
+static int scaled(int full, int reduced)
+{
+	return quick ? reduced : full;
+}
+
+// Noise long enough that no voice ends during a run, even pitched up.
+static void makeNoise(wavedata_t *pSound, int numSamples, int amplitude)
+{
+	pSound->numSamples = numSamples;
+	pSound->pData = malloc(numSamples * sizeof(*pSound->pData));
+	for (int i = 0; i < numSamples; i++) {
+		pSound->pData[i] = BenchUtil_randomRange(-amplitude, amplitude);
+	}
+}
+
+static triggerParams_t paramsForFeature(voiceFeature_t feature)
+{
+	triggerParams_t params = {TRIGGERBUS_CENTER_PAN, TRIGGERBUS_UNITY_PITCH, 0};
+	if (feature == FEATURE_PAN || feature == FEATURE_ALL) {
+		params.pan = BenchUtil_randomRange(0, TRIGGERBUS_MAX_PAN);
+	}
+	if (feature == FEATURE_PITCH || feature == FEATURE_ALL) {
+		params.pitch = BenchUtil_randomRange(TRIGGERBUS_UNITY_PITCH * 3 / 4,
+				TRIGGERBUS_UNITY_PITCH * 3 / 2);
+	}
+	if (feature == FEATURE_DECAY || feature == FEATURE_ALL) {
+		// Long enough to stay audible for the whole run.
+		params.decayMs = 10000;
+	}
+	return params;
+}
+
+// Start the mixer offline with numVoices voices queued; the first period
+// rendered starts them all.
+static void startOfflineVoices(int numVoices, voiceFeature_t feature, int sampleId,
+		int gainPercent)
+{
+	TriggerBus_init();
+	AudioMixer_initOffline(BENCH_PERIOD_FRAMES);
+	AudioMixer_setMasterGain(gainPercent);
+	BenchUtil_seed(BENCH_SEED);
+	for (int i = 0; i < numVoices; i++) {
+		triggerParams_t params = paramsForFeature(feature);
+		TriggerBus_postWithParams(TRIGGER_SOURCE_NETWORK, sampleId,
+				TRIGGERBUS_MAX_VELOCITY, &params);
+	}
+}
+
+// Start numVoices voices offline, then time the mixer over numPeriods.
+// Returns nanoseconds per output frame.
+static double timeOfflineRender(int numVoices, voiceFeature_t feature, int sampleId,
+		int gainPercent, int numPeriods)
+{
+	short *pBuffer = malloc(BENCH_PERIOD_FRAMES * AudioMixer_getNumChannels() * sizeof(*pBuffer));
+	startOfflineVoices(numVoices, feature, sampleId, gainPercent);
+	AudioMixer_renderPeriod(pBuffer);
+
+	uint64_t start = BenchUtil_nowNs();
+	for (int i = 0; i < numPeriods; i++) {
+		AudioMixer_renderPeriod(pBuffer);
+	}
+	uint64_t elapsed = BenchUtil_nowNs() - start;
+	AudioMixer_cleanup();
+	AudioMixer_setMasterGain(100);
+	free(pBuffer);
+	return (double) elapsed / ((double) numPeriods * BENCH_PERIOD_FRAMES);
+}
+
+// FNV-1a over numPeriods periods of output, to compare renders exactly.
+static uint64_t hashOfflineRender(int numVoices, voiceFeature_t feature, int numPeriods)
+{
+	int periodSamples = BENCH_PERIOD_FRAMES * AudioMixer_getNumChannels();
+	short *pBuffer = malloc(periodSamples * sizeof(*pBuffer));
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	startOfflineVoices(numVoices, feature, QUIET_SAMPLE_ID, 100);
+	for (int i = 0; i < numPeriods; i++) {
+		AudioMixer_renderPeriod(pBuffer);
+		const unsigned char *pBytes = (const unsigned char *) pBuffer;
+		for (size_t j = 0; j < periodSamples * sizeof(*pBuffer); j++) {
+			hash = (hash ^ pBytes[j]) * 0x100000001b3ULL;
+		}
+	}
+	AudioMixer_cleanup();
+	free(pBuffer);
+	return hash;
+}
+
+// Starts a result line for a render; the caller adds any checks and ends it.
+static void reportRender(const char *benchName, int numVoices, voiceFeature_t feature,
+		int numWorkers, double nsPerFrame)
+{
+	BenchUtil_begin(benchName);
+	BenchUtil_addInt("voices", numVoices);
+	BenchUtil_addString("features", featureNames[feature]);
+	BenchUtil_addInt("workers", numWorkers);
+	BenchUtil_addDouble("ns_per_frame", nsPerFrame);
+	BenchUtil_addDouble("ns_per_sample", nsPerFrame / AudioMixer_getNumChannels());
+	BenchUtil_addDouble("realtime_load_pct", nsPerFrame * BENCH_SAMPLE_RATE / 1e7);
+	// How many voices like these one core could mix in real time.
+	if (numVoices > 0) {
+		double nsPerVoiceFrame = nsPerFrame / numVoices;
+		BenchUtil_addDouble("voices_per_core", (1e9 / BENCH_SAMPLE_RATE) / nsPerVoiceFrame);
+	}
+}
+
+static void benchMixer(void)
+{
+	static const int voiceCounts[] = {0, 1, 8, 32, 128, 256};
+	static const int workerCounts[] = {1, 2, 4};
+	int numPeriods = scaled(400, 40);
+
+	AudioMixer_setMixWorkers(1);
+	for (unsigned v = 0; v < sizeof(voiceCounts) / sizeof(voiceCounts[0]); v++) {
+		for (int feature = 0; feature < FEATURE_COUNT; feature++) {
+			double nsPerFrame = timeOfflineRender(voiceCounts[v], feature,
+					QUIET_SAMPLE_ID, 100, numPeriods);
+			reportRender("mixer_render", voiceCounts[v], feature, 1, nsPerFrame);
+			BenchUtil_end();
+		}
+	}
+
+	// Long enough for the pitched voices to end at different times.
+	int hashPeriods = BENCH_SAMPLE_RATE * 5 / BENCH_PERIOD_FRAMES;
+	for (int voices = 32; voices <= 256; voices *= 8) {
+		AudioMixer_setMixWorkers(1);
+		uint64_t serialHash = hashOfflineRender(voices, FEATURE_ALL, hashPeriods);
+		for (unsigned w = 0; w < sizeof(workerCounts) / sizeof(workerCounts[0]); w++) {
+			AudioMixer_setMixWorkers(workerCounts[w]);
+			double nsPerFrame = timeOfflineRender(voices, FEATURE_ALL,
+					QUIET_SAMPLE_ID, 100, numPeriods);
+			uint64_t hash = hashOfflineRender(voices, FEATURE_ALL, hashPeriods);
+			reportRender("mixer_parallel", voices, FEATURE_ALL, workerCounts[w], nsPerFrame);
+			// How the voices are split must not change a single sample.
+			BenchUtil_check("matches_serial", hash == serialHash);
+			BenchUtil_end();
+		}
+	}
+	AudioMixer_setMixWorkers(1);
+
+	// Same voices through the output stage, below and well into the limiter.
+	double cleanNs = timeOfflineRender(8, FEATURE_UNITY, QUIET_SAMPLE_ID, 100, numPeriods);
+	double limitedNs = timeOfflineRender(8, FEATURE_UNITY, LOUD_SAMPLE_ID,
+			AUDIOMIXER_MAX_MASTER_GAIN, numPeriods);
+	BenchUtil_begin("output_stage");
+	BenchUtil_addInt("voices", 8);
+	BenchUtil_addDouble("ns_per_frame_clean", cleanNs);
+	BenchUtil_addDouble("ns_per_frame_limited", limitedNs);
+	BenchUtil_end();
+}
+
+// Known-good output of the gain and limiter stage for constant input:
+// amplitude on every voice, summed at unity pan and velocity, then master
+// gain and the soft knee. Expected values follow from the limiter curve in
+// audioMixer_template.c and must only change when that curve does.
+typedef struct {
+	const char *name;
+	int amplitude;
+	int numVoices;
+	int gainPercent;
+	int expected;
+} outputGolden_t;
+
+static const outputGolden_t outputGoldens[] = {
+	{"below_knee", 10000, 1, 100, 10000},
+	{"below_knee_negative", -10000, 1, 100, -10000},
+	{"at_knee", 24576, 1, 100, 24576},
+	{"above_knee", 28000, 1, 100, 26990},
+	{"full_scale_overdrive", 32767, 4, 100, 32181},
+	{"full_scale_overdrive_negative", -32767, 4, 100, -32181},
+	{"gain_400", 10000, 1, 400, 29925},
+	{"gain_400_overdrive", 32767, 8, 400, 32701},
+	{"gain_0", 10000, 1, 0, 0},
+};
+
+static void benchOutputGolden(void)
+{
+	int periodSamples = BENCH_PERIOD_FRAMES * AudioMixer_getNumChannels();
+	short *pBuffer = malloc(periodSamples * sizeof(*pBuffer));
+	wavedata_t constant;
+	constant.numSamples = BENCH_PERIOD_FRAMES;
+	constant.pData = malloc(constant.numSamples * sizeof(*constant.pData));
+
+	for (unsigned c = 0; c < sizeof(outputGoldens) / sizeof(outputGoldens[0]); c++) {
+		const outputGolden_t *pGolden = &outputGoldens[c];
+		for (int i = 0; i < constant.numSamples; i++) {
+			constant.pData[i] = pGolden->amplitude;
+		}
+		TriggerBus_init();
+		AudioMixer_initOffline(BENCH_PERIOD_FRAMES);
+		AudioMixer_setMasterGain(pGolden->gainPercent);
+		for (int v = 0; v < pGolden->numVoices; v++) {
+			AudioMixer_queueSound(&constant);
+		}
+		AudioMixer_renderPeriod(pBuffer);
+		AudioMixer_cleanup();
+		AudioMixer_setMasterGain(100);
+
+		int mismatches = 0;
+		for (int j = 0; j < periodSamples; j++) {
+			if (pBuffer[j] != pGolden->expected) {
+				mismatches++;
+			}
+		}
+		BenchUtil_begin("output_golden");
+		BenchUtil_addString("case", pGolden->name);
+		BenchUtil_addInt("expected", pGolden->expected);
+		BenchUtil_addInt("got", pBuffer[0]);
+		BenchUtil_check("matches", mismatches == 0);
+		BenchUtil_end();
+	}
+	AudioMixer_freeWaveFileData(&constant);
+	free(pBuffer);
+}
+
+// A decaying voice on constant input must fall steadily from its starting
+// level, be at half of it halfway through, and be silent once decayMs has
+// passed, short or long. The sample outlasts the longest decay, so only the
+// envelope can silence it.
+static void benchVoiceDecay(void)
+{
+	static const int decays[] = {100, 1000, 60000, UINT16_MAX};
+	const int amplitude = 20000;
+	int periodSamples = BENCH_PERIOD_FRAMES * AudioMixer_getNumChannels();
+	short *pBuffer = malloc(periodSamples * sizeof(*pBuffer));
+	wavedata_t constant;
+	constant.numSamples = (UINT16_MAX / 1000 + 2) * BENCH_SAMPLE_RATE;
+	constant.pData = malloc(constant.numSamples * sizeof(*constant.pData));
+	for (int i = 0; i < constant.numSamples; i++) {
+		constant.pData[i] = amplitude;
+	}
+	AudioMixer_registerSample(CONSTANT_SAMPLE_ID, &constant);
+
+	for (unsigned d = 0; d < sizeof(decays) / sizeof(decays[0]); d++) {
+		triggerParams_t params = {TRIGGERBUS_CENTER_PAN, TRIGGERBUS_UNITY_PITCH, decays[d]};
+		TriggerBus_init();
+		AudioMixer_initOffline(BENCH_PERIOD_FRAMES);
+		TriggerBus_postWithParams(TRIGGER_SOURCE_NETWORK, CONSTANT_SAMPLE_ID,
+				TRIGGERBUS_MAX_VELOCITY, &params);
+		// Render a second past the decay; the voice may only fade, never grow.
+		long long silentAfterFrames = (long long) decays[d] * BENCH_SAMPLE_RATE / 1000;
+		long long halfwayFrame = silentAfterFrames / 2;
+		int numPeriods = (silentAfterFrames + BENCH_SAMPLE_RATE) / BENCH_PERIOD_FRAMES;
+		short first = 0;
+		short halfway = 0;
+		short previous = amplitude;
+		bool fading = true;
+		bool silenced = true;
+		for (int i = 0; i < numPeriods; i++) {
+			AudioMixer_renderPeriod(pBuffer);
+			for (int j = 0; j < BENCH_PERIOD_FRAMES; j++) {
+				short sample = pBuffer[j * AudioMixer_getNumChannels()];
+				long long frame = (long long) i * BENCH_PERIOD_FRAMES + j;
+				if (frame == 0) {
+					first = sample;
+				} else if (frame == halfwayFrame) {
+					halfway = sample;
+				}
+				fading = fading && sample <= previous && sample >= 0;
+				silenced = silenced && (frame < silentAfterFrames || sample == 0);
+				previous = sample;
+			}
+		}
+		AudioMixer_cleanup();
+
+		// The envelope is linear; allow 2% for its rounding.
+		int halfwayError = abs(2 * halfway - first);
+		BenchUtil_begin("voice_decay");
+		BenchUtil_addInt("decay_ms", decays[d]);
+		BenchUtil_addInt("first_sample", first);
+		BenchUtil_addInt("halfway_sample", halfway);
+		BenchUtil_addInt("last_sample", previous);
+		BenchUtil_check("fading", fading);
+		BenchUtil_check("half_level_halfway", first > 0 && halfwayError * 50 <= first);
+		BenchUtil_check("silent_after_decay", silenced);
+		BenchUtil_end();
+	}
+	AudioMixer_registerSample(CONSTANT_SAMPLE_ID, NULL);
+	AudioMixer_freeWaveFileData(&constant);
+	free(pBuffer);
+}
+
+static void benchWavLoad(void)
+{
+	DIR *pDir = opendir(wavDir);
+	if (pDir == NULL) {
+		fprintf(stderr, "Bench: Unable to open WAV directory %s\n", wavDir);
+		return;
+	}
+	char paths[BENCH_MAX_WAV_FILES][512];
+	int numFiles = 0;
+	struct dirent *pEntry;
+	while ((pEntry = readdir(pDir)) != NULL && numFiles < BENCH_MAX_WAV_FILES) {
+		const char *pExtension = strrchr(pEntry->d_name, '.');
+		if (pExtension != NULL && strcmp(pExtension, ".wav") == 0) {
+			snprintf(paths[numFiles++], sizeof(paths[0]), "%s/%s", wavDir, pEntry->d_name);
+		}
+	}
+	closedir(pDir);
+
+	int repeats = scaled(50, 5);
+	long long totalSamples = 0;
+	uint64_t start = BenchUtil_nowNs();
+	for (int r = 0; r < repeats; r++) {
+		for (int i = 0; i < numFiles; i++) {
+			wavedata_t sound;
+			AudioMixer_readWaveFileIntoMemory(paths[i], &sound);
+			totalSamples += sound.numSamples;
+			AudioMixer_freeWaveFileData(&sound);
+		}
+	}
+	uint64_t elapsed = BenchUtil_nowNs() - start;
+
+	BenchUtil_begin("wav_load");
+	BenchUtil_addInt("files", numFiles);
+	BenchUtil_addInt("repeats", repeats);
+	BenchUtil_addDouble("ms_per_kit", (double) elapsed / repeats / NS_PER_MS);
+	BenchUtil_addDouble("ns_per_sample", totalSamples ? (double) elapsed / totalSamples : 0);
+	BenchUtil_addDouble("mb_per_s", totalSamples * sizeof(short) * 1e3 / (double) elapsed);
+	BenchUtil_end();
+}
+
+// Each producer posts a numbered sequence; the consumer checks that every
+// event arrives exactly once and in order per producer.
+#define BUS_MAX_PRODUCERS 4
+#define BUS_TIMEOUT_MS 10000
+
+typedef struct {
+	int index;
+	int numEvents;
+	atomic_bool *pGo;
+	long fullOnFirstPost;	// events that found the bus full at least once
+	long refusedPosts;		// every post the bus turned away, retries included
+} busProducer_t;
+
+static void *busProducer(void *arg)
+{
+	busProducer_t *pProducer = arg;
+	while (!atomic_load(pProducer->pGo)) {
+	}
+	triggerSource_t source = pProducer->index % TRIGGER_SOURCE_COUNT;
+	for (int i = 0; i < pProducer->numEvents; i++) {
+		// A full bus refuses the post and counts an overflow; retry like a
+		// caller that must not lose the hit.
+		bool firstPost = true;
+		while (!TriggerBus_post(source, pProducer->index, i % (TRIGGERBUS_MAX_VELOCITY + 1))) {
+			pProducer->refusedPosts++;
+			if (firstPost) {
+				pProducer->fullOnFirstPost++;
+				firstPost = false;
+			}
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void benchTriggerBus(void)
+{
+	static const int producerCounts[] = {1, 2, BUS_MAX_PRODUCERS};
+	int eventsPerProducer = scaled(200000, 20000);
+
+	for (unsigned p = 0; p < sizeof(producerCounts) / sizeof(producerCounts[0]); p++) {
+		int numProducers = producerCounts[p];
+		busProducer_t producers[BUS_MAX_PRODUCERS];
+		pthread_t ids[BUS_MAX_PRODUCERS];
+		int nextVelocity[BUS_MAX_PRODUCERS] = {0};
+		long received[BUS_MAX_PRODUCERS] = {0};
+		atomic_bool go = false;
+		TriggerBus_init();
+		for (int i = 0; i < numProducers; i++) {
+			producers[i] = (busProducer_t) {i, eventsPerProducer, &go, 0, 0};
+			pthread_create(&ids[i], NULL, busProducer, &producers[i]);
+		}
+
+		long total = (long) numProducers * eventsPerProducer;
+		long consumed = 0;
+		long reordered = 0;
+		long strays = 0;
+		uint64_t start = BenchUtil_nowNs();
+		atomic_store(&go, true);
+		while (consumed < total && BenchUtil_nowNs() - start < BUS_TIMEOUT_MS * NS_PER_MS) {
+			triggerEvent_t event;
+			if (!TriggerBus_pop(&event)) {
+				sched_yield();
+				continue;
+			}
+			consumed++;
+			if (event.sampleId >= numProducers) {
+				strays++;
+				continue;
+			}
+			if (event.velocity != nextVelocity[event.sampleId]) {
+				reordered++;
+			}
+			nextVelocity[event.sampleId] = (event.velocity + 1) % (TRIGGERBUS_MAX_VELOCITY + 1);
+			received[event.sampleId]++;
+		}
+		uint64_t elapsed = BenchUtil_nowNs() - start;
+		for (int i = 0; i < numProducers; i++) {
+			pthread_join(ids[i], NULL);
+		}
+
+		bool allDelivered = strays == 0;
+		long fullOnFirstPost = 0;
+		long refusedPosts = 0;
+		for (int i = 0; i < numProducers; i++) {
+			allDelivered = allDelivered && received[i] == eventsPerProducer;
+			fullOnFirstPost += producers[i].fullOnFirstPost;
+			refusedPosts += producers[i].refusedPosts;
+		}
+		unsigned long overflows = 0;
+		for (int s = 0; s < TRIGGER_SOURCE_COUNT; s++) {
+			overflows += TriggerBus_getOverflowCount(s);
+		}
+		BenchUtil_begin("trigger_bus");
+		BenchUtil_addInt("producers", numProducers);
+		BenchUtil_addInt("events", total);
+		BenchUtil_addDouble("triggers_per_s", consumed * 1e9 / (double) elapsed);
+		BenchUtil_addDouble("ns_per_trigger", consumed ? (double) elapsed / consumed : 0);
+		BenchUtil_addInt("full_on_first_post", fullOnFirstPost);
+		BenchUtil_addInt("overflows", overflows);
+		BenchUtil_addInt("reordered", reordered);
+		BenchUtil_check("all_delivered", allDelivered && consumed == total);
+		BenchUtil_check("in_order", reordered == 0);
+		// Every refused post must show up in the overflow counters.
+		BenchUtil_check("overflows_counted", overflows == (unsigned long) refusedPosts);
+		BenchUtil_end();
+	}
+}
+
+// Every trigger source posts hits on the same sample at once, as many
+// between two mixer periods as the bus holds. None may be refused, and each
+// hit must come out as its own event: nothing is merged.
+#define BURST_EVENTS_PER_SOURCE (TRIGGERBUS_CAPACITY / TRIGGER_SOURCE_COUNT)
+
+typedef struct {
+	triggerSource_t source;
+	int numRounds;
+	pthread_barrier_t *pBarrier;
+} burstProducer_t;
+
+static void *burstProducer(void *arg)
+{
+	burstProducer_t *pProducer = arg;
+	for (int round = 0; round < pProducer->numRounds; round++) {
+		pthread_barrier_wait(pProducer->pBarrier);
+		for (int i = 0; i < BURST_EVENTS_PER_SOURCE; i++) {
+			TriggerBus_post(pProducer->source, QUIET_SAMPLE_ID, i);
+		}
+		pthread_barrier_wait(pProducer->pBarrier);
+	}
+	return NULL;
+}
+
+static void benchTriggerBurst(void)
+{
+	int numRounds = scaled(2000, 200);
+	burstProducer_t producers[TRIGGER_SOURCE_COUNT];
+	pthread_t ids[TRIGGER_SOURCE_COUNT];
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, TRIGGER_SOURCE_COUNT + 1);
+	TriggerBus_init();
+	for (int i = 0; i < TRIGGER_SOURCE_COUNT; i++) {
+		producers[i] = (burstProducer_t) {i, numRounds, &barrier};
+		pthread_create(&ids[i], NULL, burstProducer, &producers[i]);
+	}
+
+	long drained = 0;
+	long reordered = 0;
+	long wrongCount = 0;
+	uint64_t drainNs = 0;
+	for (int round = 0; round < numRounds; round++) {
+		pthread_barrier_wait(&barrier);
+		pthread_barrier_wait(&barrier);
+		// Drain the way the mixer does at the top of a period.
+		int received[TRIGGER_SOURCE_COUNT] = {0};
+		triggerEvent_t event;
+		uint64_t start = BenchUtil_nowNs();
+		while (TriggerBus_pop(&event)) {
+			if (event.velocity != received[event.source]) {
+				reordered++;
+			}
+			received[event.source]++;
+			drained++;
+		}
+		drainNs += BenchUtil_nowNs() - start;
+		for (int i = 0; i < TRIGGER_SOURCE_COUNT; i++) {
+			if (received[i] != BURST_EVENTS_PER_SOURCE) {
+				wrongCount++;
+			}
+		}
+	}
+	for (int i = 0; i < TRIGGER_SOURCE_COUNT; i++) {
+		pthread_join(ids[i], NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	long posted = (long) numRounds * TRIGGER_SOURCE_COUNT * BURST_EVENTS_PER_SOURCE;
+	unsigned long overflows = 0;
+	for (int i = 0; i < TRIGGER_SOURCE_COUNT; i++) {
+		overflows += TriggerBus_getOverflowCount(i);
+	}
+	BenchUtil_begin("trigger_burst");
+	BenchUtil_addInt("rounds", numRounds);
+	BenchUtil_addInt("burst_size", TRIGGER_SOURCE_COUNT * BURST_EVENTS_PER_SOURCE);
+	BenchUtil_addInt("posted", posted);
+	BenchUtil_addInt("drained", drained);
+	BenchUtil_addInt("overflows", overflows);
+	BenchUtil_addDouble("drain_ns_per_trigger", drained ? (double) drainNs / drained : 0);
+	BenchUtil_check("no_overflow", overflows == 0);
+	BenchUtil_check("no_coalescing", drained == posted && wrongCount == 0);
+	BenchUtil_check("in_order", reordered == 0);
+	BenchUtil_end();
+}
+
+static void benchRecorder(void)
+{
+	int numPeriods = scaled(400, 40);
+	short *pBuffer = malloc(BENCH_PERIOD_FRAMES * AudioMixer_getNumChannels() * sizeof(*pBuffer));
+	char wavPath[512];
+	char logPath[512];
+	snprintf(wavPath, sizeof(wavPath), "%s/beatbox-bench.wav", scratchDir);
+	snprintf(logPath, sizeof(logPath), "%s/beatbox-bench.log", scratchDir);
+
+	uint64_t elapsed[2];
+	for (int record = 0; record < 2; record++) {
+		TriggerBus_init();
+		AudioMixer_initOffline(BENCH_PERIOD_FRAMES);
+		if (record && !AudioMixer_startRecording(wavPath, logPath)) {
+			fprintf(stderr, "Bench: Unable to record to %s\n", wavPath);
+			AudioMixer_cleanup();
+			free(pBuffer);
+			return;
+		}
+		BenchUtil_seed(BENCH_SEED);
+		uint64_t start = BenchUtil_nowNs();
+		for (int i = 0; i < numPeriods; i++) {
+			// A new hit every other period keeps the trigger log busy too.
+			if (i % 2 == 0) {
+				triggerParams_t params = paramsForFeature(FEATURE_ALL);
+				params.decayMs = 200;
+				TriggerBus_postWithParams(TRIGGER_SOURCE_NETWORK, QUIET_SAMPLE_ID,
+						TRIGGERBUS_MAX_VELOCITY, &params);
+			}
+			AudioMixer_renderPeriod(pBuffer);
+		}
+		elapsed[record] = BenchUtil_nowNs() - start;
+		AudioMixer_cleanup();
+	}
+	unlink(wavPath);
+	unlink(logPath);
+	free(pBuffer);
+
+	BenchUtil_begin("recorder");
+	BenchUtil_addInt("periods", numPeriods);
+	BenchUtil_addDouble("ns_per_period_off", (double) elapsed[0] / numPeriods);
+	BenchUtil_addDouble("ns_per_period_on", (double) elapsed[1] / numPeriods);
+	BenchUtil_addDouble("added_ns_per_period",
+			((double) elapsed[1] - (double) elapsed[0]) / numPeriods);
+	BenchUtil_end();
+}
+
+static int openUdpClient(struct sockaddr_in *pServer)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct timeval timeout = {0, 100 * 1000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	memset(pServer, 0, sizeof(*pServer));
+	pServer->sin_family = AF_INET;
+	pServer->sin_port = htons(BENCH_UDP_PORT);
+	pServer->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return fd;
+}
+
+static bool udpRoundTrip(int fd, const struct sockaddr_in *pServer, const char *command)
+{
+	char reply[128];
+	sendto(fd, command, strlen(command) + 1, 0,
+			(const struct sockaddr *) pServer, sizeof(*pServer));
+	return recv(fd, reply, sizeof(reply), 0) > 0;
+}
+
+// Wait until the server answers; it binds its socket after starting.
+static bool waitForUdpServer(int fd, const struct sockaddr_in *pServer)
+{
+	for (int attempt = 0; attempt < 50; attempt++) {
+		if (udpRoundTrip(fd, pServer, "ping")) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Time from sendto() until the server has posted the trigger on the bus,
+// plus the round trip of its status reply. Nothing else consumes the bus.
+static void benchUdp(void)
+{
+	int numPackets = scaled(2000, 200);
+	uint64_t *pToBus = malloc(numPackets * sizeof(*pToBus));
+	uint64_t *pRoundTrip = malloc(numPackets * sizeof(*pRoundTrip));
+	threadController controller = {-1, 1, 80, 120};
+	schedProfile_t profile;
+	SchedProfile_getFloating(&profile);
+	TriggerBus_init();
+	ThreadManager_init(&profile);
+	ThreadManager_spawn("network", THREAD_ROLE_NETWORK, networkCommunication, &controller);
+
+	struct sockaddr_in server;
+	int fd = openUdpClient(&server);
+	if (!waitForUdpServer(fd, &server)) {
+		fprintf(stderr, "Bench: UDP server did not answer on port %d\n", BENCH_UDP_PORT);
+	}
+
+	int received = 0;
+	int lost = 0;
+	for (int i = 0; i < numPackets; i++) {
+		uint64_t sentNs = BenchUtil_nowNs();
+		bool replied = udpRoundTrip(fd, &server, "sound1");
+		uint64_t repliedNs = BenchUtil_nowNs();
+		triggerEvent_t event;
+		bool posted = false;
+		while (!posted && BenchUtil_nowNs() - sentNs < 100 * NS_PER_MS) {
+			posted = TriggerBus_pop(&event);
+			if (!posted) {
+				sched_yield();
+			}
+		}
+		if (!replied || !posted) {
+			lost++;
+			continue;
+		}
+		pToBus[received] = event.timestampNs - sentNs;
+		pRoundTrip[received] = repliedNs - sentNs;
+		received++;
+		ThreadManager_sleepMs(1);
+	}
+
+	uint64_t shutdownStart = BenchUtil_nowNs();
+	char command[] = "shutdown";
+	sendto(fd, command, sizeof(command), 0, (struct sockaddr *) &server, sizeof(server));
+	ThreadManager_waitForShutdown();
+	bool allJoined = ThreadManager_joinAll(THREADMANAGER_SHUTDOWN_TIMEOUT_MS);
+	uint64_t shutdownNs = BenchUtil_nowNs() - shutdownStart;
+	close(fd);
+
+	BenchUtil_begin("udp_latency");
+	BenchUtil_addInt("packets", numPackets);
+	BenchUtil_addInt("lost", lost);
+	BenchUtil_addDouble("to_bus_p50_us", (double) BenchUtil_percentile(pToBus, received, 0.50) / NS_PER_US);
+	BenchUtil_addDouble("to_bus_p90_us", (double) BenchUtil_percentile(pToBus, received, 0.90) / NS_PER_US);
+	BenchUtil_addDouble("to_bus_p99_us", (double) BenchUtil_percentile(pToBus, received, 0.99) / NS_PER_US);
+	BenchUtil_addDouble("to_bus_max_us", (double) BenchUtil_percentile(pToBus, received, 1.0) / NS_PER_US);
+	BenchUtil_addDouble("rtt_p50_us", (double) BenchUtil_percentile(pRoundTrip, received, 0.50) / NS_PER_US);
+	BenchUtil_addDouble("rtt_p99_us", (double) BenchUtil_percentile(pRoundTrip, received, 0.99) / NS_PER_US);
+	BenchUtil_addDouble("shutdown_ms", (double) shutdownNs / NS_PER_MS);
+	// The server sits in poll() on its socket; shutdown must wake it.
+	BenchUtil_check("shutdown_bounded", allJoined && shutdownNs <= BENCH_MAX_JOIN_MS * NS_PER_MS);
+	BenchUtil_end();
+	free(pToBus);
+	free(pRoundTrip);
+}
+
+// Stands in for an accelerometer axis: a hit on every beat, cycling
+// through the axes, with random pan and pitch.
+static void *simulatedSensor(void *arg)
+{
+	int beatMs = *(int *) arg;
+	int axis = 0;
+	while (ThreadManager_sleepMs(beatMs)) {
+		triggerParams_t params = paramsForFeature(FEATURE_ALL);
+		params.decayMs = 400;
+		TriggerBus_postWithParams(TRIGGER_SOURCE_ACCEL_X + axis, QUIET_SAMPLE_ID,
+				TRIGGERBUS_MAX_VELOCITY, &params);
+		LOG_DEBUG("Hit on axis %d pan %d pitch %d", axis, params.pan, params.pitch);
+		axis = (axis + 1) % 3;
+	}
+	return NULL;
+}
+
+static void *spinLoad(void *arg)
+{
+	(void) arg;
+	volatile unsigned long spins = 0;
+	while (ThreadManager_isRunning()) {
+		spins++;
+	}
+	return NULL;
+}
+
+static void waitForFirstPeriod(void)
+{
+	audioMixerStats_t stats;
+	do {
+		sched_yield();
+		AudioMixer_getStats(&stats);
+	} while (stats.periods == 0);
+}
+
+// Startup is everything main() does before the first period is mixed;
+// shutdown runs from the request until every thread is joined and the
+// mixer is released.
+static void benchLifecycle(void)
+{
+	static int beatMs = 125;
+	threadController controller = {-1, 1, 80, 120};
+	wavedata_t kit[BENCH_MAX_WAV_FILES];
+	int kitSize = 0;
+	DIR *pDir = opendir(wavDir);
+	struct dirent *pEntry;
+
+	uint64_t start = BenchUtil_nowNs();
+	schedProfile_t profile;
+	SchedProfile_getFloating(&profile);
+	TriggerBus_init();
+	ThreadManager_init(&profile);
+	while (pDir != NULL && (pEntry = readdir(pDir)) != NULL && kitSize < BENCH_MAX_WAV_FILES) {
+		const char *pExtension = strrchr(pEntry->d_name, '.');
+		if (pExtension != NULL && strcmp(pExtension, ".wav") == 0) {
+			char path[512];
+			snprintf(path, sizeof(path), "%s/%s", wavDir, pEntry->d_name);
+			AudioMixer_readWaveFileIntoMemory(path, &kit[kitSize]);
+			kitSize++;
+		}
+	}
+	if (pDir != NULL) {
+		closedir(pDir);
+	}
+	uint64_t kitLoaded = BenchUtil_nowNs();
+	AudioMixer_init();
+	ThreadManager_spawn("network", THREAD_ROLE_NETWORK, networkCommunication, &controller);
+	ThreadManager_spawn("sim-sensor", THREAD_ROLE_SENSOR, simulatedSensor, &beatMs);
+	waitForFirstPeriod();
+	uint64_t firstPeriod = BenchUtil_nowNs();
+
+	ThreadManager_sleepMs(scaled(1000, 200));
+
+	uint64_t shutdownStart = BenchUtil_nowNs();
+	ThreadManager_requestShutdown();
+	bool allJoined = ThreadManager_joinAll(THREADMANAGER_SHUTDOWN_TIMEOUT_MS);
+	uint64_t threadsJoined = BenchUtil_nowNs();
+	AudioMixer_cleanup();
+	uint64_t shutdownEnd = BenchUtil_nowNs();
+	for (int i = 0; i < kitSize; i++) {
+		AudioMixer_freeWaveFileData(&kit[i]);
+	}
+
+	BenchUtil_begin("lifecycle");
+	BenchUtil_addInt("kit_files", kitSize);
+	BenchUtil_addDouble("kit_load_ms", (double) (kitLoaded - start) / NS_PER_MS);
+	BenchUtil_addDouble("startup_ms", (double) (firstPeriod - start) / NS_PER_MS);
+	BenchUtil_addDouble("join_ms", (double) (threadsJoined - shutdownStart) / NS_PER_MS);
+	BenchUtil_addDouble("shutdown_ms", (double) (shutdownEnd - shutdownStart) / NS_PER_MS);
+	BenchUtil_check("all_joined", allJoined);
+	BenchUtil_check("joined_promptly", threadsJoined - shutdownStart <= BENCH_MAX_JOIN_MS * NS_PER_MS);
+	// Sounds still playing may hold up the mixer for its drain timeout, no longer.
+	BenchUtil_check("shutdown_bounded", shutdownEnd - shutdownStart
+			<= (AUDIOMIXER_DRAIN_TIMEOUT_MS + BENCH_MAX_JOIN_MS) * NS_PER_MS);
+	BenchUtil_end();
+}
+
+// Live playback through the null sink, which paces like a sound card, with
+// and without CPU hogs on every core. requested is the profile asked for;
+// pinned falls back to float when there is no core to reserve.
+static void runJitter(const char *requested, const schedProfile_t *pProfile, int numSpinners)
+{
+	static int beatMs = 50;
+	TriggerBus_init();
+	ThreadManager_init(pProfile);
+	AudioMixer_init();
+	ThreadManager_spawn("sim-sensor", THREAD_ROLE_SENSOR, simulatedSensor, &beatMs);
+	// Ordinary time-shared hogs; the background role would be niced.
+	for (int i = 0; i < numSpinners; i++) {
+		ThreadManager_spawn("spin-load", THREAD_ROLE_INPUT, spinLoad, NULL);
+	}
+	uint64_t start = BenchUtil_nowNs();
+	ThreadManager_sleepMs(scaled(3000, 500));
+	audioMixerStats_t stats;
+	AudioMixer_getStats(&stats);
+	uint64_t elapsed = BenchUtil_nowNs() - start;
+	ThreadManager_requestShutdown();
+	ThreadManager_joinAll(THREADMANAGER_SHUTDOWN_TIMEOUT_MS);
+	AudioMixer_cleanup();
+
+	uint64_t periods = stats.periods ? stats.periods : 1;
+	uint64_t expectedPeriods = elapsed / stats.periodNs;
+	BenchUtil_begin("period_jitter");
+	BenchUtil_addString("requested", requested);
+	BenchUtil_addString("profile", pProfile->name);
+	BenchUtil_addInt("spinners", numSpinners);
+	BenchUtil_addInt("periods", stats.periods);
+	BenchUtil_addDouble("period_ms", (double) stats.periodNs / NS_PER_MS);
+	BenchUtil_addDouble("mix_mean_us", (double) stats.mixNsTotal / periods / NS_PER_US);
+	BenchUtil_addDouble("mix_max_us", (double) stats.mixNsMax / NS_PER_US);
+	BenchUtil_addDouble("jitter_mean_us", (double) stats.jitterNsTotal / periods / NS_PER_US);
+	BenchUtil_addDouble("jitter_max_us", (double) stats.jitterNsMax / NS_PER_US);
+	// Jitter is expected under load; falling behind the sound card is not.
+	BenchUtil_check("kept_pace", stats.periods >= expectedPeriods * BENCH_MIN_PACE_PCT / 100);
+	BenchUtil_end();
+}
+
+static void benchJitter(void)
+{
+	int numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	// normal is the baseline: no real-time priority and no pinning.
+	static const char *requested[] = {"normal", "float", "pinned"};
+	schedProfile_t profiles[3];
+	SchedProfile_getNormal(&profiles[0]);
+	SchedProfile_getFloating(&profiles[1]);
+	SchedProfile_getPinned(&profiles[2], numCpus - 1);
+	for (int p = 0; p < 3; p++) {
+		runJitter(requested[p], &profiles[p], 0);
+		runJitter(requested[p], &profiles[p], numCpus);
+	}
+}
+
+// Bursts of log calls from several threads, far more than the flusher
+// can keep up with, plus a rate-limited site.
+#define LOG_BURST 100
+static atomic_ullong logCalls;
+static atomic_ullong logCallNs;
+
+static void *logSpam(void *arg)
+{
+	(void) arg;
+	while (ThreadManager_sleepMs(1)) {
+		uint64_t start = BenchUtil_nowNs();
+		for (int i = 0; i < LOG_BURST; i++) {
+			LOG_INFO("Spam message %d of %d, volume %d tempo %d", i, LOG_BURST, 80, 120);
+			LOG_LIMITED(LOG_LEVEL_WARN, 5, "Spam warning %d", i);
+		}
+		atomic_fetch_add(&logCallNs, BenchUtil_nowNs() - start);
+		atomic_fetch_add(&logCalls, 2 * LOG_BURST);
+	}
+	return NULL;
+}
+
+typedef struct {
+	double mixMeanUs;
+	double jitterMaxUs;
+} loggingLoadResult_t;
+
+static bool withinLoggingCost(double value, double baseline, double slack)
+{
+	return value <= baseline * (100 + BENCH_LOG_MAX_COST_PCT) / 100 + slack;
+}
+
+// Live playback while other threads log heavily. With logging "off" the
+// same calls run but are filtered by level, so any difference in period
+// time is the cost of queueing and flushing messages. pBaseline is the
+// "off" run to check the async run against, NULL for the off run itself.
+static void runLoggingLoad(bool enabled, int numSpammers,
+		const loggingLoadResult_t *pBaseline, loggingLoadResult_t *pResult)
+{
+	static int beatMs = 50;
+	char logPath[512];
+	snprintf(logPath, sizeof(logPath), "%s/beatbox-bench-log.txt", scratchDir);
+	schedProfile_t profile;
+	SchedProfile_getFloating(&profile);
+	atomic_store(&logCalls, 0);
+	atomic_store(&logCallNs, 0);
+	loggerStats_t before;
+	Logger_getStats(&before);
+
+	TriggerBus_init();
+	ThreadManager_init(&profile);
+	Logger_init(logPath);
+	Logger_setLevel(enabled ? LOG_LEVEL_DEBUG : LOG_LEVEL_ERROR);
+	AudioMixer_init();
+	ThreadManager_spawn("sim-sensor", THREAD_ROLE_SENSOR, simulatedSensor, &beatMs);
+	for (int i = 0; i < numSpammers; i++) {
+		ThreadManager_spawn("log-spam", THREAD_ROLE_INPUT, logSpam, NULL);
+	}
+	uint64_t start = BenchUtil_nowNs();
+	ThreadManager_sleepMs(scaled(3000, 500));
+	audioMixerStats_t stats;
+	AudioMixer_getStats(&stats);
+	uint64_t elapsed = BenchUtil_nowNs() - start;
+	ThreadManager_requestShutdown();
+	bool allJoined = ThreadManager_joinAll(THREADMANAGER_SHUTDOWN_TIMEOUT_MS);
+	AudioMixer_cleanup();
+	Logger_cleanup(allJoined);
+	Logger_setLevel(LOG_LEVEL_INFO);
+	unlink(logPath);
+
+	loggerStats_t after;
+	Logger_getStats(&after);
+	uint64_t periods = stats.periods ? stats.periods : 1;
+	uint64_t expectedPeriods = elapsed / stats.periodNs;
+	unsigned long long calls = atomic_load(&logCalls);
+	pResult->mixMeanUs = (double) stats.mixNsTotal / periods / NS_PER_US;
+	pResult->jitterMaxUs = (double) stats.jitterNsMax / NS_PER_US;
+	BenchUtil_begin("logging_load");
+	BenchUtil_addString("logging", enabled ? "async" : "off");
+	BenchUtil_addInt("threads", numSpammers);
+	BenchUtil_addInt("periods", stats.periods);
+	BenchUtil_addDouble("mix_mean_us", pResult->mixMeanUs);
+	BenchUtil_addDouble("mix_max_us", (double) stats.mixNsMax / NS_PER_US);
+	BenchUtil_addDouble("jitter_mean_us", (double) stats.jitterNsTotal / periods / NS_PER_US);
+	BenchUtil_addDouble("jitter_max_us", pResult->jitterMaxUs);
+	BenchUtil_addInt("calls", calls);
+	BenchUtil_addDouble("ns_per_call", calls ? (double) atomic_load(&logCallNs) / calls : 0);
+	BenchUtil_addInt("logged", after.logged - before.logged);
+	BenchUtil_addInt("dropped", after.dropped - before.dropped);
+	BenchUtil_addInt("suppressed", after.suppressed - before.suppressed);
+	BenchUtil_check("kept_pace", stats.periods >= expectedPeriods * BENCH_MIN_PACE_PCT / 100);
+	if (pBaseline != NULL) {
+		BenchUtil_check("mix_within_baseline", withinLoggingCost(pResult->mixMeanUs,
+				pBaseline->mixMeanUs, BENCH_LOG_MIX_SLACK_US));
+		BenchUtil_check("jitter_within_baseline", withinLoggingCost(pResult->jitterMaxUs,
+				pBaseline->jitterMaxUs, BENCH_LOG_JITTER_SLACK_US));
+	}
+	BenchUtil_end();
+}
+
+static void benchLogging(void)
+{
+	int numSpammers = sysconf(_SC_NPROCESSORS_ONLN) + 1;
+	loggingLoadResult_t off;
+	loggingLoadResult_t async;
+	runLoggingLoad(false, numSpammers, NULL, &off);
+	runLoggingLoad(true, numSpammers, &off, &async);
+}
+
+typedef struct {
+	const char *name;
+	void (*run)(void);
+} benchSuite_t;
+
+static const benchSuite_t suites[] = {
+	{"wav", benchWavLoad},
+	{"mixer", benchMixer},
+	{"output", benchOutputGolden},
+	{"decay", benchVoiceDecay},
+	{"bus", benchTriggerBus},
+	{"burst", benchTriggerBurst},
+	{"recorder", benchRecorder},
+	{"udp", benchUdp},
+	{"lifecycle", benchLifecycle},
+	{"jitter", benchJitter},
+	{"logging", benchLogging},
+};
+#define NUM_SUITES ((int) (sizeof(suites) / sizeof(suites[0])))
+
+static void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [--out FILE] [--quick] [--wav-dir DIR] [--scratch DIR] [SUITE...]\n",
+			program);
+	fprintf(stderr, "Suites:");
+	for (int i = 0; i < NUM_SUITES; i++) {
+		fprintf(stderr, " %s", suites[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *outPath = NULL;
+	bool selected[NUM_SUITES] = {false};
+	bool anySelected = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			quick = true;
+		} else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			outPath = argv[++i];
+		} else if (strcmp(argv[i], "--wav-dir") == 0 && i + 1 < argc) {
+			wavDir = argv[++i];
+		} else if (strcmp(argv[i], "--scratch") == 0 && i + 1 < argc) {
+			scratchDir = argv[++i];
+		} else {
+			int suite = 0;
+			while (suite < NUM_SUITES && strcmp(argv[i], suites[suite].name) != 0) {
+				suite++;
+			}
+			if (suite == NUM_SUITES) {
+				usage(argv[0]);
+				return 1;
+			}
+			selected[suite] = true;
+			anySelected = true;
+		}
+	}
+	if (!BenchUtil_openResults(outPath)) {
+		return 1;
+	}
+
+	BenchUtil_begin("environment");
+	BenchUtil_addString("revision", BENCH_REVISION);
+	BenchUtil_addInt("cpus", sysconf(_SC_NPROCESSORS_ONLN));
+	BenchUtil_addInt("seed", BENCH_SEED);
+	BenchUtil_addInt("period_frames", BENCH_PERIOD_FRAMES);
+	BenchUtil_addInt("quick", quick);
+	BenchUtil_end();
+
+	BenchUtil_seed(BENCH_SEED);
+	makeNoise(&quietSample, BENCH_SAMPLE_RATE * 4, QUIET_AMPLITUDE);
+	makeNoise(&loudSample, BENCH_SAMPLE_RATE * 4, LOUD_AMPLITUDE);
+	AudioMixer_registerSample(QUIET_SAMPLE_ID, &quietSample);
+	AudioMixer_registerSample(LOUD_SAMPLE_ID, &loudSample);
+
+	for (int i = 0; i < NUM_SUITES; i++) {
+		if (!anySelected || selected[i]) {
+			fprintf(stderr, "Bench: running %s\n", suites[i].name);
+			suites[i].run();
+		}
+	}
+
+	AudioMixer_freeWaveFileData(&quietSample);
+	AudioMixer_freeWaveFileData(&loudSample);
+	BenchUtil_closeResults();
+	int failedChecks = BenchUtil_getFailedChecks();
+	if (failedChecks > 0) {
+		fprintf(stderr, "Bench: %d check%s failed\n", failedChecks, failedChecks == 1 ? "" : "s");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include "benchUtil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint32_t randomState = 1;
+static FILE *pResults = NULL;
+static bool firstField = true;
+static const char *currentBench = "";
+static int failedChecks = 0;
+
+uint64_t BenchUtil_nowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void BenchUtil_seed(uint32_t seed)
+{
+	// xorshift never leaves 0.
+	randomState = (seed != 0) ? seed : 1;
+}
+
+uint32_t BenchUtil_random(void)
+{
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return randomState;
+}
+
+int BenchUtil_randomRange(int min, int max)
+{
+	return min + (int) (BenchUtil_random() % (uint32_t) (max - min + 1));
+}
+
+static int compareValues(const void *pA, const void *pB)
+{
+	uint64_t a = *(const uint64_t *) pA;
+	uint64_t b = *(const uint64_t *) pB;
+	return (a > b) - (a < b);
+}
+
+uint64_t BenchUtil_percentile(uint64_t *pValues, int count, double fraction)
+{
+	if (count == 0) {
+		return 0;
+	}
+	qsort(pValues, count, sizeof(*pValues), compareValues);
+	int index = (int) (fraction * (count - 1) + 0.5);
+	return pValues[index];
+}
+
+bool BenchUtil_openResults(const char *pPath)
+{
+	failedChecks = 0;
+	if (pPath == NULL) {
+		pResults = stdout;
+		return true;
+	}
+	pResults = fopen(pPath, "w");
+	if (pResults == NULL) {
+		perror("Bench: Unable to open results file");
+		return false;
+	}
+	return true;
+}
+
+void BenchUtil_closeResults(void)
+{
+	if (pResults != NULL && pResults != stdout) {
+		fclose(pResults);
+	}
+	pResults = NULL;
+}
+
+static void startField(const char *key)
+{
+	fprintf(pResults, "%s\"%s\":", firstField ? "" : ",", key);
+	firstField = false;
+}
+
+void BenchUtil_begin(const char *benchName)
+{
+	fprintf(pResults, "{");
+	firstField = true;
+	currentBench = benchName;
+	BenchUtil_addString("bench", benchName);
+}
+
+// Keys and values are fixed identifiers from the benchmarks, so nothing
+// needs escaping.
+void BenchUtil_addString(const char *key, const char *value)
+{
+	startField(key);
+	fprintf(pResults, "\"%s\"", value);
+}
+
+void BenchUtil_addInt(const char *key, long long value)
+{
+	startField(key);
+	fprintf(pResults, "%lld", value);
+}
+
+void BenchUtil_addDouble(const char *key, double value)
+{
+	startField(key);
+	fprintf(pResults, "%.3f", value);
+}
+
+void BenchUtil_check(const char *key, bool passed)
+{
+	startField(key);
+	fprintf(pResults, "\"%s\"", passed ? "pass" : "fail");
+	if (!passed) {
+		fprintf(stderr, "Bench: FAILED %s %s\n", currentBench, key);
+		failedChecks++;
+	}
+}
+
+void BenchUtil_end(void)
+{
+	fprintf(pResults, "}\n");
+	fflush(pResults);
+}
+
+int BenchUtil_getFailedChecks(void)
+{
+	return failedChecks;
+}
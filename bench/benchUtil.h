@@ -0,0 +1,40 @@
+// Helpers shared by the benchmarks: a monotonic clock, a seeded random
+// source so every run sees the same input, percentiles, and the result
+// writer. Each result is one JSON object per line:
+//   {"bench":"mixer_render","voices":32,"features":"pan","ns_per_frame":812.4}
+// Results may also carry pass/fail checks, e.g. "in_order":"pass";
+// any failed check makes the benchmark exit with an error.
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+uint64_t BenchUtil_nowNs(void);
+
+// xorshift32; the same seed always produces the same sequence.
+void BenchUtil_seed(uint32_t seed);
+uint32_t BenchUtil_random(void);
+// Uniform in [min, max].
+int BenchUtil_randomRange(int min, int max);
+
+// Sorts pValues in place. fraction is 0.0 - 1.0.
+uint64_t BenchUtil_percentile(uint64_t *pValues, int count, double fraction);
+
+// Results go to pPath, or stdout if pPath is NULL.
+bool BenchUtil_openResults(const char *pPath);
+void BenchUtil_closeResults(void);
+
+// Build one result line: begin, add any number of fields, end.
+void BenchUtil_begin(const char *benchName);
+void BenchUtil_addString(const char *key, const char *value);
+void BenchUtil_addInt(const char *key, long long value);
+void BenchUtil_addDouble(const char *key, double value);
+// Adds "key":"pass" or "fail"; a failure is also reported on stderr.
+void BenchUtil_check(const char *key, bool passed);
+void BenchUtil_end(void);
+
+// Checks that failed since the results were opened.
+int BenchUtil_getFailedChecks(void);
+
+#endif
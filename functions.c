@@ -7,11 +7,9 @@
 #include <linux/i2c-dev.h>
 #include <sys/ioctl.h>
 
-#include <alsa/asoundlib.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <limits.h>
-#include <alloca.h>
 #include <stdatomic.h>
 #include <sys/socket.h>
 #include <time.h>
@@ -22,6 +20,12 @@
 #include <linux/i2c.h>
 #include "functions.h"
 #include "audioMixer_template.h"
+#include "triggerBus.h"
+#include "threadManager.h"
+#include "recorder.h"
+#include "logger.h"
+#include "simulator.h"
+#include <poll.h>
 
 #define I2CDRV_LINUX_BUS0 "/dev/i2c-0"
 #define I2CDRV_LINUX_BUS1 "/dev/i2c-1"
@@ -35,6 +39,18 @@
 #define SOURCE_FILE5 "beatbox-wav-files/100066__menegass__gui-drum-tom-mid-hard.wav"
 #define SOURCE_FILE6 "beatbox-wav-files/100065__menegass__gui-drum-tom-lo-soft.wav"
 
+// Sample ids on the trigger bus are indices into this table; "sound1" over
+// UDP plays sample id 0. Adding a sound only means adding a file here.
+static char* sampleFiles[] = {
+    SOURCE_FILE1,
+    SOURCE_FILE2,
+    SOURCE_FILE3,
+    SOURCE_FILE4,
+    SOURCE_FILE5,
+    SOURCE_FILE6,
+};
+#define NUM_SAMPLES ((int) (sizeof(sampleFiles) / sizeof(sampleFiles[0])))
+
 #define REG_TURN_ON_ACCEL 0x20
 #define READADDR 0xA8
 #define AxL 0x28
@@ -48,15 +64,16 @@
 #define REG_OUTA 0x14 // Zen Red uses: 0x00
 #define REG_OUTB 0x15 // Zen Red uses: 0x01
 
+// Accelerometer axes are read this often; after a hit an axis ignores
+// further movement for the holdoff so one swing plays one sound.
+#define ACCEL_POLL_MS 10
+#define ACCEL_HOLDOFF_MS 300
+#define JOYSTICK_POLL_MS 10
+
+// Sleeps are cut short on shutdown so no thread holds up waitForProgramEnd()
 void sleepForMs(long long delayInMs)
 {
-    const long long NS_PER_MS = 1000 * 1000;
-    const long long NS_PER_SECOND = 1000000000;
-    long long delayNs = delayInMs * NS_PER_MS;
-    int seconds = delayNs / NS_PER_SECOND;
-    int nanoseconds = delayNs % NS_PER_SECOND;
-    struct timespec reqDelay = {seconds, nanoseconds};
-    nanosleep(&reqDelay, (struct timespec *) NULL);
+    ThreadManager_sleepMs(delayInMs);
 }
 
 void configureInput(){
@@ -74,7 +91,7 @@ void configureInput(){
 }
 
 int readJoystick(int joystick){
-    FILE *pFile;
+    FILE *pFile = NULL;
     if(joystick == 1){
         pFile = fopen("/sys/class/gpio/gpio26/value", "r");
     }
@@ -90,6 +107,9 @@ int readJoystick(int joystick){
     if(joystick == 5){
         pFile = fopen("/sys/class/gpio/gpio27/value", "r");
     }
+    if(pFile == NULL){
+        return 0;
+    }
     char buff[1024];
     fgets(buff, 1024, pFile);
     fclose(pFile);
@@ -137,219 +157,232 @@ static unsigned char readI2cReg(int i2cFileDesc, unsigned char regAddr){
     return value;
 }
 
+// One poll of the joystick: apply every pressed direction and return how
+// long to wait before the next poll. Shared by the joystick thread and the
+// simulator.
+long long joystickStep(threadController* threadData, const bool pressed[JOYSTICK_NUM_DIRECTIONS]){
+    long long waitMs = JOYSTICK_POLL_MS;
+    if(pressed[JOYSTICK_UP]){
+        if(threadData->volume < 95){
+            threadData->volume += 5;
+        }
+        else{
+            threadData->volume = 100;
+        }
+        AudioMixer_setVolume(threadData->volume);
+        LOG_INFO("Volume : %d",threadData->volume);
+        waitMs += 150;
+    }
+    if(pressed[JOYSTICK_DOWN]){
+        if(threadData->volume > 5){
+            threadData->volume -= 5;
+        }
+        else{
+            threadData->volume = 0;
+        }
+        AudioMixer_setVolume(threadData->volume);
+        LOG_INFO("Volume : %d",threadData->volume);
+        waitMs += 150;
+    }
+    if(pressed[JOYSTICK_LEFT]){
+        if(threadData->tempo > 45){
+            threadData->tempo -= 5;
+        }
+        else{
+            threadData->tempo = 40;
+        }
+        LOG_INFO("Tempo : %d",threadData->tempo);
+        waitMs += 150;
+    }
+    if(pressed[JOYSTICK_RIGHT]){
+        if(threadData->tempo < 295){
+            threadData->tempo -= 5;
+        }else{
+            threadData->tempo = 300;
+        }
+        LOG_INFO("Tempo : %d",threadData->tempo);
+        waitMs += 150;
+    }
+    if(pressed[JOYSTICK_PUSH]){
+        if(threadData->mode == 3){
+            threadData->mode = 1;
+        } else{
+            threadData->mode++;
+        }
+        LOG_INFO("Mode : %d",threadData->mode);
+        waitMs += 300;
+    }
+    return waitMs;
+}
+
 void* monitorJoystick(void* args){
     configureInput();
     threadController* threadData = (threadController*) args;
     threadData->volume = 80;
     AudioMixer_setVolume(threadData->volume);
     threadData->tempo = 120;
-    while(threadData->programRunning){
-        if(readJoystick(1)){
-            if(threadData->volume < 95){
-                threadData->volume += 5;
-                AudioMixer_setVolume(threadData->volume);
-            }
-            else{
-                threadData->volume = 100;
-                AudioMixer_setVolume(threadData->volume);
-            }
-            printf("Volume : %d\n",threadData->volume);
-            sleepForMs(150);
-        }
-        if(readJoystick(2)){
-            if(threadData->volume > 5){
-                threadData->volume -= 5;
-                AudioMixer_setVolume(threadData->volume);
-            }
-            else{
-                threadData->volume = 0;
-                AudioMixer_setVolume(threadData->volume);
-            }
-            printf("Volume : %d\n",threadData->volume);
-            sleepForMs(150);
-        }
-        if(readJoystick(3)){
-            if(threadData->tempo > 45){
-                threadData->tempo -= 5;
-            }
-            else{
-                threadData->tempo = 40;
-            }
-            printf("Tempo : %d\n",threadData->tempo);
-            sleepForMs(150);
-        }
-        if(readJoystick(4)){
-            if(threadData->tempo < 295){
-                threadData->tempo -= 5;
-            }else{
-                threadData->tempo = 300;
-            }
-            printf("Tempo : %d\n",threadData->tempo);
-            sleepForMs(150);
-        }
-        if(readJoystick(5)){
-            if(threadData->mode == 3){
-                threadData->mode = 1;
-            } else{
-                threadData->mode++;
-            }
-            printf("Mode : %d\n",threadData->mode);
-            sleepForMs(300);
+    while(ThreadManager_isRunning()){
+        bool pressed[JOYSTICK_NUM_DIRECTIONS];
+        for(int i = 0; i < JOYSTICK_NUM_DIRECTIONS; i++){
+            pressed[i] = readJoystick(i + 1);
         }
-        sleepForMs(10);
+        sleepForMs(joystickStep(threadData, pressed));
     }
     pthread_exit(0);
 }
 
+void printStatus(threadController* threadData){
+    LOG_INFO("M%d %dbpm vol:%d Audio[] Accel",threadData->mode,threadData->tempo,threadData->volume);
+}
+
 void* printData(void* args){
     threadController* threadData = (threadController*) args;
-    while(threadData->programRunning){
-        printf("M%d %dbpm vol:%d Audio[] Accel\n",threadData->mode,threadData->tempo,threadData->volume);
-        sleep(1);
+    while(ThreadManager_isRunning()){
+        printStatus(threadData);
+        sleepForMs(STATUS_INTERVAL_MS);
     }
     pthread_exit(0);
 }
 
-void* monitorAccelerometerX(void* args){
-    threadController* threadData = (threadController*) args;
-    unsigned char buffx[9];
-    for(int i = 0; i < 9; i++){
-        buffx[i] = 0;
-    }
-    while(threadData->programRunning){
-       *buffx = readI2cReg(threadData->i2cFileDesc,0x28);
-       *(buffx + 4) = readI2cReg(threadData->i2cFileDesc,0x29);
-        int16_t x = (buffx[4] << 8) | (buffx[0]);
-
-        if((x > 32000 || x < -32000)){
-            atomic_store(&threadData->hitX,1);
-            sleepForMs(300);
-        }
-        sleepForMs(10);
+// Sample played by a hit on the given axis in the current drum mode,
+// or -1 if the mode is silent.
+static int sampleForHit(int mode, triggerSource_t axis){
+    int axisIndex = axis - TRIGGER_SOURCE_ACCEL_X;
+    if(mode == 1){
+        return axisIndex;
+    } else if(mode == 2){
+        return 3 + axisIndex;
+    }
+    return -1;
+}
+
+static void postHit(threadController* threadData, triggerSource_t axis){
+    int sampleId = sampleForHit(threadData->mode, axis);
+    if(sampleId >= 0){
+        TriggerBus_post(axis, sampleId, TRIGGERBUS_MAX_VELOCITY);
+    }
+}
+
+// One reading of an accelerometer axis: a reading near full scale is a hit,
+// after which the axis ignores movement for a while so one swing is one
+// hit. Returns how long to wait before the next reading.
+long long accelerometerStep(threadController* threadData, triggerSource_t axis, int16_t reading){
+    if(reading > 32000 || reading < -32000){
+        postHit(threadData, axis);
+        return ACCEL_HOLDOFF_MS + ACCEL_POLL_MS;
     }
+    return ACCEL_POLL_MS;
+}
+
+static void monitorAxis(threadController* threadData, triggerSource_t axis, unsigned char lowReg, unsigned char highReg){
+    while(ThreadManager_isRunning()){
+        unsigned char low = readI2cReg(threadData->i2cFileDesc,lowReg);
+        unsigned char high = readI2cReg(threadData->i2cFileDesc,highReg);
+        int16_t reading = (high << 8) | low;
+        sleepForMs(accelerometerStep(threadData, axis, reading));
+    }
+}
+
+void* monitorAccelerometerX(void* args){
+    monitorAxis((threadController*) args, TRIGGER_SOURCE_ACCEL_X, AxL, AxH);
     pthread_exit(0);
 }
 
 void* monitorAccelerometerY(void* args){
-    threadController* threadData = (threadController*) args;
-    unsigned char buffy[9];
-        for(int i = 0; i < 9; i++){
-        buffy[i] = 0;
-    }
-    while(threadData->programRunning){
-       *buffy = readI2cReg(threadData->i2cFileDesc,0x2A);
-       *(buffy + 4) = readI2cReg(threadData->i2cFileDesc,0x2B);
-        int16_t y = (buffy[4] << 8) | (buffy[0]);
-
-        if((y > 32000 || y < -32000)){
-            atomic_store(&threadData->hitY,1);
-            sleepForMs(300);
-        }
-        sleepForMs(10);
-    }
+    monitorAxis((threadController*) args, TRIGGER_SOURCE_ACCEL_Y, AyL, AyH);
     pthread_exit(0);
 }
 
 void* monitorAccelerometerZ(void* args){
-    threadController* threadData = (threadController*) args;
-    unsigned char buffz[9];
-    for(int i = 0; i < 9; i++){
-        buffz[i] = 0;
-    }
-    while(threadData->programRunning){
-       *buffz = readI2cReg(threadData->i2cFileDesc,0x2C);
-       *(buffz + 4) = readI2cReg(threadData->i2cFileDesc,0x2D);
-        int16_t z = (buffz[4] << 8) | (buffz[0]);
-        if((z > 32000 || z < -32000)){
-            //threadData->hitZ++;
-            atomic_store(&threadData->hitZ,1);
-            sleepForMs(300);
+    monitorAxis((threadController*) args, TRIGGER_SOURCE_ACCEL_Z, AzL, AzH);
+    pthread_exit(0);
+}
+
+void startSessionRecording(void){
+    //Record the session as <name>.wav plus a trigger log <name>.log that replaySession() can render
+    const char* recordName = getenv("BEATBOX_RECORD");
+    if(recordName){
+        char wavPath[256];
+        char logPath[256];
+        snprintf(wavPath, sizeof(wavPath), "%s.wav", recordName);
+        snprintf(logPath, sizeof(logPath), "%s.log", recordName);
+        if(!AudioMixer_startRecording(wavPath, logPath)){
+            LOG_ERROR("Unable to record to %s", wavPath);
         }
-        sleepForMs(10);
     }
-    pthread_exit(0);
+}
+
+void setMixWorkersFromEnvironment(void){
+    //Large kits on multi-core hosts can spread mixing over several threads
+    const char* mixWorkers = getenv("BEATBOX_MIX_WORKERS");
+    if(mixWorkers){
+        AudioMixer_setMixWorkers(atoi(mixWorkers));
+    }
 }
 
 void* playSound(void* args){
-    threadController* threadData = (threadController*) args;
-    wavedata_t sampleFile1;
-    wavedata_t sampleFile2;
-    wavedata_t sampleFile3;
-    wavedata_t sampleFile4;
-    wavedata_t sampleFile5;
-    wavedata_t sampleFile6;
+    (void) args;
+    wavedata_t samples[NUM_SAMPLES];
+    setMixWorkersFromEnvironment();
     AudioMixer_init();
-    AudioMixer_readWaveFileIntoMemory(SOURCE_FILE1, &sampleFile1);
-    AudioMixer_readWaveFileIntoMemory(SOURCE_FILE2, &sampleFile2);
-    AudioMixer_readWaveFileIntoMemory(SOURCE_FILE3, &sampleFile3);
-    AudioMixer_readWaveFileIntoMemory(SOURCE_FILE4, &sampleFile4);
-    AudioMixer_readWaveFileIntoMemory(SOURCE_FILE5, &sampleFile5);
-    AudioMixer_readWaveFileIntoMemory(SOURCE_FILE6, &sampleFile6);
-    while(threadData->programRunning){
-        int mode = threadData->mode;
-      if(threadData->hitX){
-        printf("Hit X\n");
-        if(mode == 1){
-            AudioMixer_queueSound(&sampleFile1);
-        } else if (mode == 2){
-            AudioMixer_queueSound(&sampleFile4);
-        }
-        atomic_store(&threadData->hitX,0);
-      }
-      if(threadData->hitY){
-        if(mode == 1){
-            AudioMixer_queueSound(&sampleFile2);
-        } else if (mode == 2){
-            AudioMixer_queueSound(&sampleFile5);
-        }
-        printf("Hit Y\n");
-        atomic_store(&threadData->hitY,0);
-      }
-      if(threadData->hitZ){
-        if(mode == 1){
-            AudioMixer_queueSound(&sampleFile3);
-        } else if (mode == 2){
-            AudioMixer_queueSound(&sampleFile6);
-        }
-        printf("Hit Z\n");
-        atomic_store(&threadData->hitZ,0);
-      }
-        if(threadData->playsound1){
-           AudioMixer_queueSound(&sampleFile1);
-           atomic_store(&threadData->playsound1,0); 
-        }
-        if(threadData->playsound2){
-           AudioMixer_queueSound(&sampleFile2);
-           atomic_store(&threadData->playsound2,0); 
-        }
-        if(threadData->playsound3){
-           AudioMixer_queueSound(&sampleFile3);
-           atomic_store(&threadData->playsound3,0); 
-        }
-        if(threadData->playsound4){
-           AudioMixer_queueSound(&sampleFile4);
-           atomic_store(&threadData->playsound4,0); 
-        }
-        if(threadData->playsound5){
-           AudioMixer_queueSound(&sampleFile5);
-           atomic_store(&threadData->playsound5,0); 
-        }
-        if(threadData->playsound6){
-           AudioMixer_queueSound(&sampleFile6);
-           atomic_store(&threadData->playsound6,0); 
-        }
-      sleepForMs((60/threadData->tempo/2)*1000);
+    startSessionRecording();
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        AudioMixer_readWaveFileIntoMemory(sampleFiles[i], &samples[i]);
+        AudioMixer_registerSample(i, &samples[i]);
     }
+    //Triggers go straight from the bus to the mixer, this thread only owns the samples
+    ThreadManager_waitForShutdown();
     AudioMixer_cleanup();
-    AudioMixer_freeWaveFileData(&sampleFile1);
-    AudioMixer_freeWaveFileData(&sampleFile2);
-    AudioMixer_freeWaveFileData(&sampleFile3);
-    AudioMixer_freeWaveFileData(&sampleFile4);
-    AudioMixer_freeWaveFileData(&sampleFile5);
-    AudioMixer_freeWaveFileData(&sampleFile6);
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        AudioMixer_freeWaveFileData(&samples[i]);
+    }
     pthread_exit(0);
 }
 
+int replaySession(char* logPath, char* wavPath){
+    wavedata_t samples[NUM_SAMPLES];
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        AudioMixer_readWaveFileIntoMemory(sampleFiles[i], &samples[i]);
+        AudioMixer_registerSample(i, &samples[i]);
+    }
+    bool replayed = Recorder_replay(logPath, wavPath);
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        AudioMixer_freeWaveFileData(&samples[i]);
+    }
+    return replayed ? 0 : 1;
+}
+
+int simulateSession(char* scriptPath, char* wavPath, int repeats, const char* expectedHash){
+    wavedata_t samples[NUM_SAMPLES];
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        AudioMixer_readWaveFileIntoMemory(sampleFiles[i], &samples[i]);
+        AudioMixer_registerSample(i, &samples[i]);
+    }
+    //Same starting state as startProgram() and monitorJoystick()
+    threadController controller = {-1, 1, 80, 120};
+    AudioMixer_setVolume(controller.volume);
+    simulatorResult_t result;
+    bool simulated = Simulator_run(scriptPath, wavPath, repeats, &controller, &result);
+    for(int i = 0; i < NUM_SAMPLES; i++){
+        AudioMixer_freeWaveFileData(&samples[i]);
+    }
+    if(!simulated){
+        return 1;
+    }
+    double wallSeconds = result.wallNs / 1e9;
+    printf("Simulated %.1f s in %.3f s (%.0fx real time), %lu triggers%s\n",
+            result.simulatedMs / 1000.0, wallSeconds,
+            wallSeconds > 0 ? result.simulatedMs / 1000.0 / wallSeconds : 0.0,
+            result.triggers, result.shutdownRequested ? ", ended by shutdown" : "");
+    printf("Audio hash %016llx\n", (unsigned long long) result.audioHash);
+    //Regression check: the rendered audio must match a known-good run bit for bit
+    if(expectedHash && strtoull(expectedHash, NULL, 16) != result.audioHash){
+        printf("Audio hash does not match expected %s\n", expectedHash);
+        return 1;
+    }
+    return 0;
+}
+
 void runCommand(char* command)
 {
     FILE *pipe = popen(command, "r");
@@ -365,6 +398,90 @@ void runCommand(char* command)
         printf(" exit code: %d\n", exitCode);
     }
 }
+// Value of "<name><number>" in a command, clamped to min - max, or
+// fallback if the command does not mention it.
+static int parseOption(const char* command, const char* name, int fallback, int min, int max){
+    const char* option = strstr(command, name);
+    if(!option){
+        return fallback;
+    }
+    long value = strtol(option + strlen(name), NULL, 10);
+    if(value < min){
+        return min;
+    }
+    if(value > max){
+        return max;
+    }
+    return value;
+}
+
+// Apply one UDP command packet. reply gets the status as it was before the
+// command. Returns true if the command asked the program to shut down.
+bool processCommand(threadController* threadData, const char* command, char* reply, size_t replySize){
+    snprintf(reply,replySize,"Volume : %d Tempo : %d Mode : %d",threadData->volume,threadData->tempo,threadData->mode);
+    if(strstr(command,"mode")){
+        if(threadData->mode == 3){
+            threadData->mode = 1;
+        }
+        else{
+            threadData->mode++;
+        }  
+    }
+    if(strstr(command,"volume+")){
+        if(threadData->volume < 95){
+            threadData->volume += 5;
+        }
+        else{
+            threadData->volume = 100;
+        } 
+        AudioMixer_setVolume(threadData->volume); 
+    }
+    if(strstr(command,"volume-")){
+        if(threadData->volume > 5){
+            threadData->volume -= 5;
+        }
+        else{
+            threadData->volume = 0;
+        }
+        AudioMixer_setVolume(threadData->volume);  
+    }
+    if(strstr(command,"tempo+")){
+        if(threadData->tempo > 45){
+            threadData->tempo -= 5;
+        }
+        else{
+            threadData->tempo = 40;
+        }  
+    }
+    if(strstr(command,"tempo-")){
+        if(threadData->tempo < 295){
+            threadData->tempo += 5;
+        }
+        else{
+            threadData->tempo = 300;
+        }  
+    }
+    //Every "soundN" in the packet is its own trigger, so "sound1 sound1" plays twice.
+    //Optional "pan=0-127", "pitch=<percent>" and "decay=<ms>" apply to all of them.
+    //Values are clamped before they are narrowed into the event, so "pan=300" is hard right
+    triggerParams_t params;
+    params.pan = parseOption(command, "pan=", TRIGGERBUS_CENTER_PAN, 0, TRIGGERBUS_MAX_PAN);
+    params.pitch = parseOption(command, "pitch=", 100,
+            TRIGGERBUS_MIN_PITCH * 100 / TRIGGERBUS_UNITY_PITCH,
+            TRIGGERBUS_MAX_PITCH * 100 / TRIGGERBUS_UNITY_PITCH) * TRIGGERBUS_UNITY_PITCH / 100;
+    params.decayMs = parseOption(command, "decay=", 0, 0, UINT16_MAX);
+    const char* soundCommand = strstr(command,"sound");
+    while(soundCommand){
+        char* end;
+        long soundNumber = strtol(soundCommand + strlen("sound"), &end, 10);
+        if(end != soundCommand + strlen("sound") && soundNumber >= 1 && soundNumber <= NUM_SAMPLES){
+            TriggerBus_postWithParams(TRIGGER_SOURCE_NETWORK, soundNumber - 1, TRIGGERBUS_MAX_VELOCITY, &params);
+        }
+        soundCommand = strstr(soundCommand + 1,"sound");
+    }
+    return strstr(command,"shutdown") != NULL;
+}
+
 void* networkCommunication(void* args){
     threadController* threadData = (threadController*) args;
     char recBuffer[65000];
@@ -379,142 +496,71 @@ void* networkCommunication(void* args){
     servaddr.sin_family = AF_INET;
     bind(listenfd, (struct sockaddr*) &servaddr, sizeof(servaddr));
     len = sizeof(cliaddr);
-    while(threadData->programRunning) {
-        recvfrom(listenfd,recBuffer,sizeof(recBuffer),0,(struct sockaddr*) &cliaddr, &len);
-        printf("Got message %s\n",recBuffer);
-        sprintf(sendBuffer,"Volume : %d Tempo : %d Mode : %d",threadData->volume,threadData->tempo,threadData->mode);
-        sendto(listenfd,sendBuffer,99,0,(struct sockaddr*) &cliaddr,len);
-        if(strstr(recBuffer,"mode")){
-            if(threadData->mode == 3){
-                threadData->mode = 1;
-            }
-            else{
-                threadData->mode++;
-            }  
-        }
-        if(strstr(recBuffer,"volume+")){
-            if(threadData->volume < 95){
-                threadData->volume += 5;
-            }
-            else{
-                threadData->volume = 100;
-            } 
-            AudioMixer_setVolume(threadData->volume); 
-        }
-        if(strstr(recBuffer,"volume-")){
-            if(threadData->volume > 5){
-                threadData->volume -= 5;
-            }
-            else{
-                threadData->volume = 0;
-            }
-            AudioMixer_setVolume(threadData->volume);  
-        }
-        if(strstr(recBuffer,"tempo+")){
-            if(threadData->tempo > 45){
-                threadData->tempo -= 5;
-            }
-            else{
-                threadData->tempo = 40;
-            }  
-        }
-        if(strstr(recBuffer,"tempo-")){
-            if(threadData->tempo < 295){
-                threadData->tempo += 5;
-            }
-            else{
-                threadData->tempo = 300;
-            }  
+    //Wait on the socket and the shutdown eventfd so shutdown never waits for a packet
+    struct pollfd pollFds[2];
+    pollFds[0].fd = listenfd;
+    pollFds[0].events = POLLIN;
+    pollFds[1].fd = ThreadManager_getShutdownFd();
+    pollFds[1].events = POLLIN;
+    while(ThreadManager_isRunning()) {
+        if(poll(pollFds, 2, -1) < 0 || !(pollFds[0].revents & POLLIN)){
+            continue;
         }
-        if(strstr(recBuffer,"sound1")){
-            atomic_store(&threadData->playsound1,1);    
-        }
-        if(strstr(recBuffer,"sound2")){
-            atomic_store(&threadData->playsound2,1);   
-        }
-        if(strstr(recBuffer,"sound3")){
-            atomic_store(&threadData->playsound3,1);    
-        }
-        if(strstr(recBuffer,"sound4")){
-            atomic_store(&threadData->playsound4,1);
-        } 
-        if(strstr(recBuffer,"sound5")){
-            atomic_store(&threadData->playsound5,1);    
+        len = sizeof(cliaddr);
+        ssize_t received = recvfrom(listenfd,recBuffer,sizeof(recBuffer) - 1,0,(struct sockaddr*) &cliaddr, &len);
+        recBuffer[received > 0 ? received : 0] = '\0';
+        //A flood of packets must not turn into a flood of output
+        LOG_LIMITED(LOG_LEVEL_INFO, 10, "Got message %s",recBuffer);
+        bool shutdownRequested = processCommand(threadData, recBuffer, sendBuffer, sizeof(sendBuffer));
+        sendto(listenfd,sendBuffer,99,0,(struct sockaddr*) &cliaddr,len);
+        if(shutdownRequested){
+            ThreadManager_requestShutdown();
         }
-        if(strstr(recBuffer,"sound6")){
-            atomic_store(&threadData->playsound6,1);     
-        }  
-        if(strstr(recBuffer,"shutdown")){
-            threadData->programRunning = 0;     
-        }    
         memset(recBuffer,0,sizeof(recBuffer));
     }
+    close(listenfd);
     pthread_exit(0);
 }
 
 
-void startProgram(threadController* threadArgument){
+bool startProgram(threadController* threadArgument){
     threadArgument->mode = 1;
     runCommand("config-pin p9_18 i2c");
 	runCommand("config-pin p9_17 i2c");
     threadArgument->i2cFileDesc = initI2cBus(I2CDRV_LINUX_BUS1, I2C_DEVICE_ADDRESS);
     writeI2cReg(threadArgument->i2cFileDesc,REG_TURN_ON_ACCEL,0x00);
     writeI2cReg(threadArgument->i2cFileDesc,REG_TURN_ON_ACCEL,0x27);
-    threadArgument->hitX = 0;
-    threadArgument->hitY = 0;
-    threadArgument->hitZ = 0;
-    threadArgument->playsound1 = 0;
-    threadArgument->playsound2 = 0;
-    threadArgument->playsound3 = 0;
-    threadArgument->playsound4 = 0;
-    threadArgument->playsound5 = 0;
-    threadArgument->playsound6 = 0;
-    pthread_t tid;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    threadArgument->programRunning = 1;
+    TriggerBus_init();
+    schedProfile_t profile;
+    SchedProfile_fromEnvironment(&profile);
+    ThreadManager_init(&profile);
+    //Messages are queued per thread and written by the logger thread; BEATBOX_LOG_FILE sends them to a file
+    Logger_init(getenv("BEATBOX_LOG_FILE"));
     //Start acceleromter monitoring threads
-    pthread_create(&tid, &attr, monitorAccelerometerX, threadArgument);
-    threadArgument->threadIDs[0] = tid;
-    pthread_create(&tid, &attr, monitorAccelerometerY, threadArgument);
-    threadArgument->threadIDs[1] = tid;
-    pthread_create(&tid, &attr, monitorAccelerometerZ, threadArgument);
-    threadArgument->threadIDs[2] = tid;
+    ThreadManager_spawn("accel-x", THREAD_ROLE_SENSOR, monitorAccelerometerX, threadArgument);
+    ThreadManager_spawn("accel-y", THREAD_ROLE_SENSOR, monitorAccelerometerY, threadArgument);
+    ThreadManager_spawn("accel-z", THREAD_ROLE_SENSOR, monitorAccelerometerZ, threadArgument);
     //Start data printing thread
-    pthread_create(&tid, &attr, printData, threadArgument);
-    threadArgument->threadIDs[3] = tid;
-    //play sound thread
-    pthread_create(&tid, &attr, playSound, threadArgument);
-    threadArgument->threadIDs[4] = tid;
+    ThreadManager_spawn("print-data", THREAD_ROLE_BACKGROUND, printData, threadArgument);
+    //play sound thread; not background, the mixer threads it starts inherit its nice value
+    ThreadManager_spawn("play-sound", THREAD_ROLE_INPUT, playSound, threadArgument);
     //monitorJoystick thread
-    pthread_create(&tid, &attr, monitorJoystick, threadArgument);
-    threadArgument->threadIDs[5] = tid;
-    pthread_create(&tid, &attr, networkCommunication, threadArgument);
-    threadArgument->threadIDs[6] = tid;
+    ThreadManager_spawn("joystick", THREAD_ROLE_INPUT, monitorJoystick, threadArgument);
+    ThreadManager_spawn("network", THREAD_ROLE_NETWORK, networkCommunication, threadArgument);
     //Wait for threads to gracefully return
-    waitForProgramEnd(threadArgument);
+    return waitForProgramEnd(threadArgument);
 }
 
-void waitForProgramEnd(threadController* threadArgument){
-
-    //Wait for accelerometer thread to join gracefully
-    pthread_join(threadArgument->threadIDs[0],NULL);
+bool waitForProgramEnd(threadController* threadArgument){
+    (void) threadArgument;
+    ThreadManager_waitForShutdown();
 
-    //Wait for printing thread to join gracefully
-    pthread_join(threadArgument->threadIDs[1],NULL);
-
-    //Wait for printing thread to join gracefully
-    pthread_join(threadArgument->threadIDs[2],NULL);
-
-    //Wait for printing thread to join gracefully
-    pthread_join(threadArgument->threadIDs[3],NULL);
-
-    //Wait for printing thread to join gracefully
-    pthread_join(threadArgument->threadIDs[4],NULL);
-
-    //Wait for printing thread to join gracefully
-    pthread_join(threadArgument->threadIDs[5],NULL);
-
-    //Wait for printing thread to join gracefully
-    pthread_join(threadArgument->threadIDs[6],NULL);
-}
\ No newline at end of file
+    //Every thread is woken by the shutdown request, so this is bounded even if one misbehaves
+    bool allStopped = ThreadManager_joinAll(THREADMANAGER_SHUTDOWN_TIMEOUT_MS);
+    if(!allStopped){
+        LOG_WARN("Not every thread stopped within %d ms", THREADMANAGER_SHUTDOWN_TIMEOUT_MS);
+    }
+    Logger_cleanup(allStopped);
+    ThreadManager_reportCpuTimes();
+    return allStopped;
+}
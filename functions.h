@@ -1,29 +1,32 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
-#include <alsa/asoundlib.h>
 #include "audioMixer_template.h"
 #include <stdatomic.h>
 
 
 #define SOURCE_FILE "wave-files/100060__menegass__gui-drum-splash-hard.wav"
-#define SAMPLE_RATE   44100
-#define NUM_CHANNELS  1
-#define SAMPLE_SIZE   (sizeof(short)) 	// bytes per sample
-snd_pcm_t *Audio_openDevice();
-void Audio_playFile(snd_pcm_t *handle, wavedata_t *pWaveData);
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "triggerBus.h"
+
+#define STATUS_INTERVAL_MS 1000
+
+// Joystick directions in the order readJoystick() numbers them, from 1.
+typedef enum {
+    JOYSTICK_UP,
+    JOYSTICK_DOWN,
+    JOYSTICK_LEFT,
+    JOYSTICK_RIGHT,
+    JOYSTICK_PUSH,
+    JOYSTICK_NUM_DIRECTIONS
+} joystickDirection_t;
 
 typedef struct threadController{
-    //Hit on X
-    atomic_int hitX;
-    //Hit on Y
-    atomic_int hitY;
-    //Hit on Z
-    atomic_int hitZ;
-    //boolean int to control startup and shutdown of threads
-    int programRunning;
-    //array of thread ID's
-    pthread_t* threadIDs;
     //i2c file desc
     int i2cFileDesc;
     //drum mode
@@ -32,21 +35,42 @@ typedef struct threadController{
     int volume;
     //tempo
     int tempo;
-    // play sounds individually
-    atomic_int playsound1;
-    atomic_int playsound2;
-    atomic_int playsound3;
-    atomic_int playsound4;
-    atomic_int playsound5;
-    atomic_int playsound6;
 } threadController;
 
-void startProgram(threadController* threadArgument);
+// Both return false if a thread missed the shutdown deadline and may still
+// be using threadArgument, which must then not be freed.
+bool startProgram(threadController* threadArgument);
+
+bool waitForProgramEnd(threadController* threadArgument);
+
+// If BEATBOX_RECORD=<name> is set, record the mixer output to <name>.wav
+// and the triggers to <name>.log; call right after the mixer is started.
+void startSessionRecording(void);
 
-void waitForProgramEnd(threadController* threadArgument);
+// BEATBOX_MIX_WORKERS=<n> mixes on n threads; call before the mixer starts.
+void setMixWorkersFromEnvironment(void);
+
+// Render a trigger log recorded with BEATBOX_RECORD back into a WAV file.
+int replaySession(char* logPath, char* wavPath);
 
 void* playSound(void* args);
 
+// UDP command server on port 12345; runs until shutdown is requested.
+void* networkCommunication(void* args);
+
+// Bodies of the input threads, one poll or packet at a time, so the
+// simulator can drive them from its own clock. The step functions return
+// how long to wait before the next poll.
+long long accelerometerStep(threadController* threadData, triggerSource_t axis, int16_t reading);
+long long joystickStep(threadController* threadData, const bool pressed[JOYSTICK_NUM_DIRECTIONS]);
+void printStatus(threadController* threadData);
+bool processCommand(threadController* threadData, const char* command, char* reply, size_t replySize);
+
+// Run a scripted session through the simulator, see simulator.h.
+int simulateSession(char* scriptPath, char* wavPath, int repeats, const char* expectedHash);
+
 void* monitorAccelerometer(void* args);
 
-void* printData(void* args);
\ No newline at end of file
+void* printData(void* args);
+
+#endif
@@ -0,0 +1,343 @@
+#include "logger.h"
+#include "threadManager.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#define NS_PER_SECOND 1000000000LL
+#define NS_PER_MS 1000000LL
+#define MAX_PENDING (LOGGER_MAX_THREADS * LOGGER_RING_ENTRIES)
+
+typedef enum {
+	RING_FREE,
+	RING_OWNED,
+	RING_RELEASED,		// owner exited; recycled once drained
+} ringState_t;
+
+typedef struct {
+	uint64_t timestampNs;
+	int level;
+	int suppressed;
+	char message[LOGGER_MESSAGE_SIZE];
+} logEntry_t;
+
+// Single producer (the owning thread), single consumer (the flusher).
+typedef struct {
+	atomic_int state;
+	atomic_bool writing;	// owner is between the running check and publishing
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_ulong dropped;
+	logEntry_t entries[LOGGER_RING_ENTRIES];
+} logRing_t;
+
+static const char *levelNames[LOG_LEVEL_COUNT] = {
+	"debug",
+	"info",
+	"warn",
+	"error",
+};
+
+static logRing_t rings[LOGGER_MAX_THREADS];
+static pthread_key_t ringKey;
+static bool keyCreated = false;
+static atomic_bool running = false;
+static atomic_int minLevel = LOG_LEVEL_INFO;
+static atomic_ulong loggedCount;
+static atomic_ulong unringedCount;
+static atomic_ulong suppressedCount;
+static pthread_t flusherThreadId;
+static FILE *pOutput = NULL;
+static loggerStats_t statsAtInit;
+
+// Scratch for one flush: every pending entry, sorted into time order.
+static logEntry_t *pending[MAX_PENDING];
+static unsigned int flushHeads[LOGGER_MAX_THREADS];
+
+static uint64_t nowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static void releaseRing(void *arg)
+{
+	logRing_t *pRing = arg;
+	atomic_store(&pRing->state, RING_RELEASED);
+}
+
+static logRing_t *getThreadRing(void)
+{
+	logRing_t *pRing = pthread_getspecific(ringKey);
+	if (pRing != NULL) {
+		return pRing;
+	}
+	for (int i = 0; i < LOGGER_MAX_THREADS; i++) {
+		int expected = RING_FREE;
+		if (atomic_compare_exchange_strong(&rings[i].state, &expected, RING_OWNED)) {
+			pthread_setspecific(ringKey, &rings[i]);
+			return &rings[i];
+		}
+	}
+	return NULL;
+}
+
+// Fixed one-second windows: cheap, and good enough to stop a loop from
+// flooding the output.
+static bool passesRateLimit(logSite_t *pSite, uint64_t timeNs, int *pSuppressed)
+{
+	long long windowStart = atomic_load_explicit(&pSite->windowStartNs, memory_order_relaxed);
+	if ((long long) timeNs - windowStart >= NS_PER_SECOND
+			&& atomic_compare_exchange_strong(&pSite->windowStartNs, &windowStart, timeNs)) {
+		atomic_store(&pSite->countInWindow, 0);
+	}
+	if (atomic_fetch_add(&pSite->countInWindow, 1) >= pSite->maxPerSecond) {
+		atomic_fetch_add(&pSite->suppressed, 1);
+		atomic_fetch_add_explicit(&suppressedCount, 1, memory_order_relaxed);
+		return false;
+	}
+	*pSuppressed = atomic_exchange(&pSite->suppressed, 0);
+	return true;
+}
+
+static void writeEntry(const logEntry_t *pEntry)
+{
+	FILE *pStream = pOutput;
+	if (pStream == NULL) {
+		pStream = (pEntry->level >= LOG_LEVEL_WARN) ? stderr : stdout;
+	} else {
+		fprintf(pStream, "%llu.%06llu %-5s ",
+				(unsigned long long) (pEntry->timestampNs / NS_PER_SECOND),
+				(unsigned long long) (pEntry->timestampNs % NS_PER_SECOND / 1000),
+				levelNames[pEntry->level]);
+	}
+	if (pEntry->suppressed > 0) {
+		fprintf(pStream, "%s (%d similar messages suppressed)\n",
+				pEntry->message, pEntry->suppressed);
+	} else {
+		fprintf(pStream, "%s\n", pEntry->message);
+	}
+}
+
+void Logger_log(logLevel_t level, logSite_t *pSite, const char *format, ...)
+{
+	if (level < atomic_load_explicit(&minLevel, memory_order_relaxed)) {
+		return;
+	}
+	uint64_t timeNs = nowNs();
+	int suppressed = 0;
+	if (pSite != NULL && !passesRateLimit(pSite, timeNs, &suppressed)) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	logRing_t *pRing = NULL;
+	if (atomic_load(&running)) {
+		pRing = getThreadRing();
+		if (pRing == NULL) {
+			va_end(args);
+			atomic_fetch_add_explicit(&unringedCount, 1, memory_order_relaxed);
+			return;
+		}
+		// Pairs with cleanup(): either cleanup() sees writing and waits for
+		// this entry before its last flush, or this sees running cleared.
+		atomic_store(&pRing->writing, true);
+		if (!atomic_load(&running)) {
+			atomic_store(&pRing->writing, false);
+			pRing = NULL;
+		}
+	}
+	if (pRing == NULL) {
+		logEntry_t entry = {timeNs, level, suppressed, ""};
+		vsnprintf(entry.message, sizeof(entry.message), format, args);
+		va_end(args);
+		writeEntry(&entry);
+		atomic_fetch_add_explicit(&loggedCount, 1, memory_order_relaxed);
+		return;
+	}
+
+	unsigned int head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+	if (head - tail >= LOGGER_RING_ENTRIES) {
+		va_end(args);
+		atomic_fetch_add_explicit(&pRing->dropped, 1, memory_order_relaxed);
+		atomic_store(&pRing->writing, false);
+		return;
+	}
+	logEntry_t *pEntry = &pRing->entries[head % LOGGER_RING_ENTRIES];
+	pEntry->timestampNs = timeNs;
+	pEntry->level = level;
+	pEntry->suppressed = suppressed;
+	vsnprintf(pEntry->message, sizeof(pEntry->message), format, args);
+	va_end(args);
+	atomic_store_explicit(&pRing->head, head + 1, memory_order_release);
+	atomic_store(&pRing->writing, false);
+}
+
+static int compareEntries(const void *pA, const void *pB)
+{
+	const logEntry_t *a = *(logEntry_t *const *) pA;
+	const logEntry_t *b = *(logEntry_t *const *) pB;
+	return (a->timestampNs > b->timestampNs) - (a->timestampNs < b->timestampNs);
+}
+
+// Only ever called by one thread at a time: the flusher, or cleanup()
+// after the flusher has been joined.
+static void flushRings(void)
+{
+	int numPending = 0;
+	for (int i = 0; i < LOGGER_MAX_THREADS; i++) {
+		logRing_t *pRing = &rings[i];
+		if (atomic_load(&pRing->state) == RING_FREE) {
+			continue;
+		}
+		unsigned int tail = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+		flushHeads[i] = atomic_load_explicit(&pRing->head, memory_order_acquire);
+		for (unsigned int j = tail; j != flushHeads[i]; j++) {
+			pending[numPending++] = &pRing->entries[j % LOGGER_RING_ENTRIES];
+		}
+	}
+	if (numPending > 0) {
+		// Entries from one thread are already in order; this interleaves threads.
+		qsort(pending, numPending, sizeof(pending[0]), compareEntries);
+		for (int i = 0; i < numPending; i++) {
+			writeEntry(pending[i]);
+		}
+		fflush(pOutput != NULL ? pOutput : stdout);
+		atomic_fetch_add_explicit(&loggedCount, numPending, memory_order_relaxed);
+	}
+
+	for (int i = 0; i < LOGGER_MAX_THREADS; i++) {
+		logRing_t *pRing = &rings[i];
+		int state = atomic_load(&pRing->state);
+		if (state == RING_FREE) {
+			continue;
+		}
+		atomic_store_explicit(&pRing->tail, flushHeads[i], memory_order_release);
+		// The owner has exited; nothing can be added behind the drained entries.
+		if (state == RING_RELEASED && atomic_load(&pRing->head) == flushHeads[i]) {
+			atomic_store(&pRing->state, RING_FREE);
+		}
+	}
+}
+
+static void *flusherThread(void *arg)
+{
+	(void) arg;
+	ThreadManager_configureCurrentThread("logger", THREAD_ROLE_BACKGROUND);
+	const struct timespec interval = {0, LOGGER_FLUSH_INTERVAL_MS * NS_PER_MS};
+	while (atomic_load(&running)) {
+		flushRings();
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+void Logger_setLevelFromEnvironment(void)
+{
+	const char *levelName = getenv("BEATBOX_LOG_LEVEL");
+	if (levelName == NULL) {
+		return;
+	}
+	for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+		if (strcmp(levelName, levelNames[i]) == 0) {
+			Logger_setLevel(i);
+			return;
+		}
+	}
+	fprintf(stderr, "Logger: Unknown level %s\n", levelName);
+}
+
+void Logger_init(const char *pPath)
+{
+	if (!keyCreated) {
+		pthread_key_create(&ringKey, releaseRing);
+		keyCreated = true;
+	}
+	Logger_setLevelFromEnvironment();
+	Logger_getStats(&statsAtInit);
+	pOutput = NULL;
+	if (pPath != NULL) {
+		pOutput = fopen(pPath, "w");
+		if (pOutput == NULL) {
+			perror("Logger: Unable to open log file");
+		}
+	}
+	atomic_store(&running, true);
+	if (pthread_create(&flusherThreadId, NULL, flusherThread, NULL) != 0) {
+		fprintf(stderr, "Logger: Unable to start flusher, logging synchronously\n");
+		atomic_store(&running, false);
+	}
+}
+
+// Written directly: the rings are no longer drained.
+static void reportLosses(void)
+{
+	loggerStats_t stats;
+	Logger_getStats(&stats);
+	unsigned long dropped = stats.dropped - statsAtInit.dropped;
+	unsigned long suppressed = stats.suppressed - statsAtInit.suppressed;
+	if (dropped == 0 && suppressed == 0) {
+		return;
+	}
+	logEntry_t entry = {nowNs(), LOG_LEVEL_WARN, 0, ""};
+	snprintf(entry.message, sizeof(entry.message),
+			"Logger: %lu messages dropped, %lu suppressed by rate limits",
+			dropped, suppressed);
+	writeEntry(&entry);
+}
+
+void Logger_cleanup(bool threadsStopped)
+{
+	if (!atomic_load(&running)) {
+		return;
+	}
+	atomic_store(&running, false);
+	pthread_join(flusherThreadId, NULL);
+	// A thread that passed the running check before it was cleared may
+	// still be filling in its entry; wait so the last flush includes it.
+	const struct timespec pause = {0, 100000};
+	for (int i = 0; i < LOGGER_MAX_THREADS; i++) {
+		while (atomic_load(&rings[i].writing)) {
+			nanosleep(&pause, NULL);
+		}
+	}
+	flushRings();
+	reportLosses();
+	if (pOutput == NULL) {
+		return;
+	}
+	if (!threadsStopped) {
+		// Threads still running log straight to the file from now on.
+		fflush(pOutput);
+		return;
+	}
+	fclose(pOutput);
+	pOutput = NULL;
+}
+
+void Logger_setLevel(logLevel_t level)
+{
+	atomic_store(&minLevel, level);
+}
+
+bool Logger_isEnabled(logLevel_t level)
+{
+	return level >= atomic_load_explicit(&minLevel, memory_order_relaxed);
+}
+
+void Logger_getStats(loggerStats_t *pStats)
+{
+	unsigned long dropped = atomic_load(&unringedCount);
+	for (int i = 0; i < LOGGER_MAX_THREADS; i++) {
+		dropped += atomic_load(&rings[i].dropped);
+	}
+	pStats->logged = atomic_load(&loggedCount);
+	pStats->dropped = dropped;
+	pStats->suppressed = atomic_load(&suppressedCount);
+}
@@ -0,0 +1,83 @@
+// Asynchronous logging for threads that must never block on I/O. A log
+// call formats the message into a ring owned by the calling thread (no
+// locks, no system calls) and a low-priority flusher thread writes the
+// rings out in time order. A full ring drops the message and counts it.
+//
+// Messages below the level set by BEATBOX_LOG_LEVEL (debug, info, warn,
+// error; default info) cost one atomic load. Call sites that can fire in
+// a loop use the _LIMITED macros, which let through at most a fixed number
+// of messages per second and report how many were suppressed.
+//
+// Before init() and after cleanup() messages are written synchronously,
+// so offline tools keep working without a flusher.
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Per-thread rings; a thread's ring is recycled once it exits and drains.
+#define LOGGER_MAX_THREADS 32
+#define LOGGER_RING_ENTRIES 64
+#define LOGGER_MESSAGE_SIZE 120
+#define LOGGER_FLUSH_INTERVAL_MS 20
+
+typedef enum {
+	LOG_LEVEL_DEBUG,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_COUNT
+} logLevel_t;
+
+// Rate limit state for one call site; see LOG_LIMITED().
+typedef struct {
+	int maxPerSecond;
+	atomic_llong windowStartNs;
+	atomic_int countInWindow;
+	atomic_int suppressed;
+} logSite_t;
+
+#define LOGGER_SITE_INIT(maxPerSecond) {(maxPerSecond), 0, 0, 0}
+
+typedef struct {
+	unsigned long logged;		// messages written out
+	unsigned long dropped;		// lost to a full ring or no free ring
+	unsigned long suppressed;	// held back by a rate limit
+} loggerStats_t;
+
+// Start the flusher; call after ThreadManager_init() so it gets its role.
+// Output goes to pPath, or stdout (debug, info) and stderr (warn, error)
+// if pPath is NULL.
+void Logger_init(const char *pPath);
+// Flush everything still queued, stop the flusher and report any messages
+// dropped or suppressed since init(). Pass threadsStopped = false if
+// threads that log may still be running (e.g. detached after a join
+// timeout); the log file is then flushed but left open for them.
+void Logger_cleanup(bool threadsStopped);
+
+void Logger_setLevel(logLevel_t level);
+// Apply BEATBOX_LOG_LEVEL; init() does this too.
+void Logger_setLevelFromEnvironment(void);
+bool Logger_isEnabled(logLevel_t level);
+
+// pSite may be NULL for no rate limit.
+void Logger_log(logLevel_t level, logSite_t *pSite, const char *format, ...)
+		__attribute__((format(printf, 3, 4)));
+
+void Logger_getStats(loggerStats_t *pStats);
+
+#define LOG_DEBUG(...) Logger_log(LOG_LEVEL_DEBUG, NULL, __VA_ARGS__)
+#define LOG_INFO(...) Logger_log(LOG_LEVEL_INFO, NULL, __VA_ARGS__)
+#define LOG_WARN(...) Logger_log(LOG_LEVEL_WARN, NULL, __VA_ARGS__)
+#define LOG_ERROR(...) Logger_log(LOG_LEVEL_ERROR, NULL, __VA_ARGS__)
+
+// At most maxPerSecond messages a second from this call site.
+#define LOG_LIMITED(level, maxPerSecond, ...) \
+	do { \
+		static logSite_t logSite = LOGGER_SITE_INIT(maxPerSecond); \
+		Logger_log((level), &logSite, __VA_ARGS__); \
+	} while (0)
+
+#endif
@@ -1,15 +1,74 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <limits.h>
 #include "functions.h"
 #include "audioMixer_template.h"
+#include "logger.h"
 
-int main(){
+static void printUsage(const char* program){
+    fprintf(stderr,
+            "Usage: %s\n"
+            "       %s --replay <log> <wav>\n"
+            "       %s --simulate <script> [--out <wav>] [--repeat <n>] [--expect <hash>]\n",
+            program, program, program);
+}
+
+int main(int argc, char** argv){
+    Logger_setLevelFromEnvironment();
+    if(argc >= 2 && strcmp(argv[1], "--replay") == 0){
+        if(argc != 4){
+            printUsage(argv[0]);
+            return 1;
+        }
+        return replaySession(argv[2], argv[3]);
+    }
+    //--simulate <script> [--out <wav>] [--repeat <n>] [--expect <hash>] runs without hardware
+    if(argc >= 2 && strcmp(argv[1], "--simulate") == 0){
+        if(argc < 3){
+            printUsage(argv[0]);
+            return 1;
+        }
+        char* wavPath = NULL;
+        int repeats = 1;
+        const char* expectedHash = NULL;
+        for(int i = 3; i < argc; i += 2){
+            //every option takes exactly one operand
+            if(i + 1 >= argc){
+                fprintf(stderr, "Missing operand for %s\n", argv[i]);
+                printUsage(argv[0]);
+                return 1;
+            }
+            if(strcmp(argv[i], "--out") == 0){
+                wavPath = argv[i + 1];
+            } else if(strcmp(argv[i], "--repeat") == 0){
+                char* end;
+                long value = strtol(argv[i + 1], &end, 10);
+                if(*end != '\0' || value < 1 || value > INT_MAX){
+                    fprintf(stderr, "Invalid repeat count %s\n", argv[i + 1]);
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                repeats = (int) value;
+            } else if(strcmp(argv[i], "--expect") == 0){
+                expectedHash = argv[i + 1];
+            } else {
+                fprintf(stderr, "Unknown option %s\n", argv[i]);
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        return simulateSession(argv[2], wavPath, repeats, expectedHash);
+    }
+    if(argc != 1){
+        printUsage(argv[0]);
+        return 1;
+    }
     threadController* threadArguments = (threadController*) malloc(sizeof(threadController));
-    pthread_t* threadIDs = (pthread_t*) malloc(sizeof(pthread_t) * 10);
-    threadArguments->threadIDs = threadIDs;
-    startProgram(threadArguments);
-    free(threadIDs);
-    free(threadArguments);
+    //A thread that missed the shutdown deadline may still be reading the arguments
+    if(startProgram(threadArguments)){
+        free(threadArguments);
+    }
     return 0;
 }
@@ -0,0 +1,108 @@
+// Workers sleep on a futex over the run generation. run() bumps the
+// generation and wakes them; the last worker to finish wakes the caller
+// through a second futex over the count of parts still pending.
+#define _GNU_SOURCE
+#include "mixPool.h"
+#include "threadManager.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static pthread_t workerIds[MIXPOOL_MAX_PARTS];
+static int workerParts[MIXPOOL_MAX_PARTS];
+static int numPoolParts = 0;
+static mixPoolJob_t poolJob = NULL;
+
+static atomic_int generation;
+static atomic_int pendingParts;
+static atomic_bool stopping;
+
+static void futexWait(atomic_int *address, int expected)
+{
+	syscall(SYS_futex, (int *) address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(atomic_int *address)
+{
+	syscall(SYS_futex, (int *) address, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void *workerThread(void *arg)
+{
+	int part = *(int *) arg;
+	ThreadManager_configureCurrentThread("mix-worker", THREAD_ROLE_MIX_WORKER);
+
+	int seenGeneration = 0;
+	for (;;) {
+		int current;
+		while ((current = atomic_load_explicit(&generation, memory_order_acquire)) == seenGeneration) {
+			futexWait(&generation, seenGeneration);
+		}
+		seenGeneration = current;
+		if (atomic_load(&stopping)) {
+			break;
+		}
+
+		poolJob(part, numPoolParts);
+
+		if (atomic_fetch_sub_explicit(&pendingParts, 1, memory_order_acq_rel) == 1) {
+			futexWake(&pendingParts);
+		}
+	}
+	return NULL;
+}
+
+bool MixPool_init(int numParts, mixPoolJob_t job)
+{
+	if (numParts < 1 || numParts > MIXPOOL_MAX_PARTS) {
+		fprintf(stderr, "MixPool: %d parts is outside 1 - %d\n", numParts, MIXPOOL_MAX_PARTS);
+		return false;
+	}
+	poolJob = job;
+	numPoolParts = numParts;
+	atomic_store(&generation, 0);
+	atomic_store(&pendingParts, 0);
+	atomic_store(&stopping, false);
+
+	for (int part = 1; part < numParts; part++) {
+		workerParts[part] = part;
+		int err = pthread_create(&workerIds[part], NULL, workerThread, &workerParts[part]);
+		if (err != 0) {
+			fprintf(stderr, "MixPool: Unable to start worker %d: %s\n", part, strerror(err));
+			numPoolParts = part;
+			MixPool_cleanup();
+			return false;
+		}
+	}
+	return true;
+}
+
+void MixPool_run(void)
+{
+	atomic_store_explicit(&pendingParts, numPoolParts - 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+	futexWake(&generation);
+
+	poolJob(0, numPoolParts);
+
+	int pending;
+	while ((pending = atomic_load_explicit(&pendingParts, memory_order_acquire)) != 0) {
+		futexWait(&pendingParts, pending);
+	}
+}
+
+void MixPool_cleanup(void)
+{
+	atomic_store(&stopping, true);
+	atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+	futexWake(&generation);
+	for (int part = 1; part < numPoolParts; part++) {
+		pthread_join(workerIds[part], NULL);
+	}
+	numPoolParts = 0;
+}
@@ -0,0 +1,23 @@
+// Small persistent worker pool used by the mixer to split one period's
+// work across cores. A run hands every worker its part number and returns
+// once all parts are done; hand-off and completion use atomics and futexes,
+// never a lock, so a run fits inside the audio period deadline.
+#ifndef MIX_POOL_H
+#define MIX_POOL_H
+
+#include <stdbool.h>
+
+#define MIXPOOL_MAX_PARTS 8
+
+typedef void (*mixPoolJob_t)(int part, int numParts);
+
+// Start numParts - 1 worker threads; the caller of run() does part 0.
+bool MixPool_init(int numParts, mixPoolJob_t job);
+
+// Run job on every part and wait for all of them to finish.
+void MixPool_run(void);
+
+// Stop and join the workers.
+void MixPool_cleanup(void);
+
+#endif
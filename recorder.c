@@ -0,0 +1,478 @@
+// Both rings are single-producer (the playback thread) single-consumer
+// (the writer thread), so a pair of atomic counters per ring is enough.
+// The writer stages output in page-aligned 64 KiB chunks and only calls
+// write() with whole chunks, except for the final flush.
+#include "recorder.h"
+#include "audioMixer_template.h"
+#include "threadManager.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define WRITE_CHUNK_BYTES (64 * 1024)
+#define WRITE_ALIGNMENT 4096
+#define WAV_HEADER_BYTES 44
+#define IDLE_SLEEP_MS 10
+
+typedef struct {
+	int fd;
+	uint8_t *buffer;
+	size_t used;
+	uint64_t totalBytes;
+} chunkWriter_t;
+
+static chunkWriter_t wavWriter;
+static chunkWriter_t logWriter;
+// Written synchronously by the offline renderers.
+static chunkWriter_t offlineWriter;
+static int offlineChannels = 0;
+static int offlineSampleRate = 0;
+static int recordChannels = 0;
+static int recordSampleRate = 0;
+static int recordPeriodFrames = 0;
+
+static short *ringSamples = NULL;
+static int ringFrames[RECORDER_RING_PERIODS];
+static atomic_uint ringHead;
+static atomic_uint ringTail;
+static recorderLogRecord_t ringEvents[RECORDER_RING_EVENTS];
+static atomic_uint eventHead;
+static atomic_uint eventTail;
+
+static atomic_bool active = false;
+// Taken by start() before it does anything, so only one caller can start.
+static atomic_bool claimed = false;
+static atomic_bool stopping = false;
+static pthread_t writerThreadId;
+static uint64_t framesRecorded = 0;
+static unsigned long droppedPeriods = 0;
+static unsigned long droppedEvents = 0;
+static unsigned long periodsTeed = 0;
+static long long teeTotalNs = 0;
+static long long teeMaxNs = 0;
+
+static long long getTimeNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void putLe16(uint8_t *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void putLe32(uint8_t *p, uint32_t value)
+{
+	putLe16(p, value);
+	putLe16(p + 2, value >> 16);
+}
+
+static void fillWavHeader(uint8_t *header, int numChannels, int sampleRate, uint32_t dataBytes)
+{
+	int blockAlign = numChannels * sizeof(short);
+	memcpy(header, "RIFF", 4);
+	putLe32(header + 4, 36 + dataBytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	putLe32(header + 16, 16);
+	putLe16(header + 20, 1);	// PCM
+	putLe16(header + 22, numChannels);
+	putLe32(header + 24, sampleRate);
+	putLe32(header + 28, sampleRate * blockAlign);
+	putLe16(header + 32, blockAlign);
+	putLe16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	putLe32(header + 40, dataBytes);
+}
+
+static bool openChunkWriter(chunkWriter_t *pWriter, const char *path)
+{
+	pWriter->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (pWriter->fd < 0) {
+		fprintf(stderr, "ERROR: Unable to open %s for recording.\n", path);
+		return false;
+	}
+	void *buffer = NULL;
+	if (posix_memalign(&buffer, WRITE_ALIGNMENT, WRITE_CHUNK_BYTES) != 0) {
+		fprintf(stderr, "ERROR: Unable to allocate recorder buffer.\n");
+		close(pWriter->fd);
+		return false;
+	}
+	pWriter->buffer = buffer;
+	pWriter->used = 0;
+	pWriter->totalBytes = 0;
+	return true;
+}
+
+static void flushChunkWriter(chunkWriter_t *pWriter)
+{
+	size_t written = 0;
+	while (written < pWriter->used) {
+		ssize_t result = write(pWriter->fd, pWriter->buffer + written, pWriter->used - written);
+		if (result <= 0) {
+			int err = errno;
+			char reason[64];
+			if (strerror_r(err, reason, sizeof(reason)) != 0) {
+				snprintf(reason, sizeof(reason), "error %d", err);
+			}
+			LOG_LIMITED(LOG_LEVEL_ERROR, 1, "Recorder: write failed: %s", reason);
+			break;
+		}
+		written += result;
+	}
+	pWriter->used = 0;
+}
+
+static void appendChunkWriter(chunkWriter_t *pWriter, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	pWriter->totalBytes += size;
+	while (size > 0) {
+		size_t space = WRITE_CHUNK_BYTES - pWriter->used;
+		size_t amount = size < space ? size : space;
+		memcpy(pWriter->buffer + pWriter->used, bytes, amount);
+		pWriter->used += amount;
+		bytes += amount;
+		size -= amount;
+		if (pWriter->used == WRITE_CHUNK_BYTES) {
+			flushChunkWriter(pWriter);
+		}
+	}
+}
+
+static void closeChunkWriter(chunkWriter_t *pWriter)
+{
+	flushChunkWriter(pWriter);
+	close(pWriter->fd);
+	free(pWriter->buffer);
+	pWriter->buffer = NULL;
+}
+
+static void appendRecord(chunkWriter_t *pWriter, recorderEventType_t type, uint64_t frame)
+{
+	recorderLogRecord_t record;
+	memset(&record, 0, sizeof(record));
+	record.type = type;
+	record.frame = frame;
+	appendChunkWriter(pWriter, &record, sizeof(record));
+}
+
+static void appendLogHeader(chunkWriter_t *pWriter, int sampleRate, int numChannels, int periodFrames)
+{
+	recorderLogHeader_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECORDER_LOG_MAGIC, sizeof(header.magic));
+	header.version = RECORDER_LOG_VERSION;
+	header.sampleRate = sampleRate;
+	header.numChannels = numChannels;
+	header.periodFrames = periodFrames;
+	appendChunkWriter(pWriter, &header, sizeof(header));
+}
+
+// Finish a WAV file whose placeholder header went out with the first chunk.
+static void finishWav(chunkWriter_t *pWriter, int numChannels, int sampleRate)
+{
+	flushChunkWriter(pWriter);
+	uint8_t header[WAV_HEADER_BYTES];
+	fillWavHeader(header, numChannels, sampleRate, pWriter->totalBytes - WAV_HEADER_BYTES);
+	if (pwrite(pWriter->fd, header, sizeof(header), 0) != sizeof(header)) {
+		perror("Recorder: Unable to finish WAV header");
+	}
+	closeChunkWriter(pWriter);
+}
+
+static bool drainRings(void)
+{
+	bool didWork = false;
+	int periodSamples = recordPeriodFrames * recordChannels;
+
+	unsigned int tail = atomic_load_explicit(&ringTail, memory_order_relaxed);
+	while (tail != atomic_load_explicit(&ringHead, memory_order_acquire)) {
+		int slot = tail % RECORDER_RING_PERIODS;
+		appendChunkWriter(&wavWriter, ringSamples + slot * periodSamples,
+				ringFrames[slot] * recordChannels * sizeof(short));
+		framesRecorded += ringFrames[slot];
+		tail++;
+		atomic_store_explicit(&ringTail, tail, memory_order_release);
+		didWork = true;
+	}
+
+	tail = atomic_load_explicit(&eventTail, memory_order_relaxed);
+	while (tail != atomic_load_explicit(&eventHead, memory_order_acquire)) {
+		appendChunkWriter(&logWriter, &ringEvents[tail % RECORDER_RING_EVENTS],
+				sizeof(recorderLogRecord_t));
+		tail++;
+		atomic_store_explicit(&eventTail, tail, memory_order_release);
+		didWork = true;
+	}
+	return didWork;
+}
+
+static void *writerThread(void *arg)
+{
+	(void) arg;
+	ThreadManager_configureCurrentThread("recorder", THREAD_ROLE_BACKGROUND);
+	const struct timespec idleDelay = {0, IDLE_SLEEP_MS * 1000 * 1000};
+	for (;;) {
+		bool stopRequested = atomic_load(&stopping);
+		if (!drainRings()) {
+			if (stopRequested) {
+				break;
+			}
+			nanosleep(&idleDelay, NULL);
+		}
+	}
+	return NULL;
+}
+
+bool Recorder_start(const char *wavPath, const char *logPath,
+		int sampleRate, int numChannels, int periodFrames)
+{
+	if (atomic_exchange(&claimed, true)) {
+		return false;
+	}
+	if (!openChunkWriter(&wavWriter, wavPath)) {
+		atomic_store(&claimed, false);
+		return false;
+	}
+	if (!openChunkWriter(&logWriter, logPath)) {
+		closeChunkWriter(&wavWriter);
+		atomic_store(&claimed, false);
+		return false;
+	}
+	recordChannels = numChannels;
+	recordSampleRate = sampleRate;
+	recordPeriodFrames = periodFrames;
+	ringSamples = malloc(RECORDER_RING_PERIODS * periodFrames * numChannels * sizeof(short));
+	if (ringSamples == NULL) {
+		fprintf(stderr, "ERROR: Unable to allocate recorder ring.\n");
+		closeChunkWriter(&wavWriter);
+		closeChunkWriter(&logWriter);
+		atomic_store(&claimed, false);
+		return false;
+	}
+
+	uint8_t header[WAV_HEADER_BYTES];
+	fillWavHeader(header, numChannels, sampleRate, 0);
+	appendChunkWriter(&wavWriter, header, sizeof(header));
+	appendLogHeader(&logWriter, sampleRate, numChannels, periodFrames);
+
+	atomic_store(&ringHead, 0);
+	atomic_store(&ringTail, 0);
+	atomic_store(&eventHead, 0);
+	atomic_store(&eventTail, 0);
+	framesRecorded = 0;
+	droppedPeriods = 0;
+	droppedEvents = 0;
+	periodsTeed = 0;
+	teeTotalNs = 0;
+	teeMaxNs = 0;
+	atomic_store(&stopping, false);
+	pthread_create(&writerThreadId, NULL, writerThread, NULL);
+	atomic_store(&active, true);
+	return true;
+}
+
+void Recorder_stop(void)
+{
+	if (!atomic_load(&active)) {
+		return;
+	}
+	atomic_store(&active, false);
+	atomic_store(&stopping, true);
+	pthread_join(writerThreadId, NULL);
+
+	appendRecord(&logWriter, RECORDER_EVENT_END, framesRecorded);
+	closeChunkWriter(&logWriter);
+	finishWav(&wavWriter, recordChannels, recordSampleRate);
+	free(ringSamples);
+	ringSamples = NULL;
+
+	LOG_INFO("Recorder: %llu frames, tee cost avg %lld ns max %lld ns per period",
+			(unsigned long long) framesRecorded,
+			periodsTeed ? teeTotalNs / (long long) periodsTeed : 0, teeMaxNs);
+	if (droppedPeriods || droppedEvents) {
+		LOG_WARN("Recorder: writer fell behind, dropped %lu periods and %lu events; "
+				"replay will not match", droppedPeriods, droppedEvents);
+	}
+	atomic_store(&claimed, false);
+}
+
+void Recorder_waitForWriter(void)
+{
+	const struct timespec delay = {0, 1000 * 1000};
+	while (atomic_load(&active)
+			&& (atomic_load(&ringHead) - atomic_load(&ringTail) > RECORDER_RING_PERIODS / 2
+				|| atomic_load(&eventHead) - atomic_load(&eventTail) > RECORDER_RING_EVENTS / 2)) {
+		nanosleep(&delay, NULL);
+	}
+}
+
+bool Recorder_isActive(void)
+{
+	return atomic_load(&active);
+}
+
+void Recorder_writePeriod(const short *pSamples, int frames)
+{
+	long long startNs = getTimeNs();
+	unsigned int head = atomic_load_explicit(&ringHead, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ringTail, memory_order_acquire) == RECORDER_RING_PERIODS) {
+		droppedPeriods++;
+		return;
+	}
+	int slot = head % RECORDER_RING_PERIODS;
+	if (frames > recordPeriodFrames) {
+		frames = recordPeriodFrames;
+	}
+	memcpy(ringSamples + slot * recordPeriodFrames * recordChannels, pSamples,
+			frames * recordChannels * sizeof(short));
+	ringFrames[slot] = frames;
+	atomic_store_explicit(&ringHead, head + 1, memory_order_release);
+
+	long long elapsedNs = getTimeNs() - startNs;
+	periodsTeed++;
+	teeTotalNs += elapsedNs;
+	if (elapsedNs > teeMaxNs) {
+		teeMaxNs = elapsedNs;
+	}
+}
+
+static void pushEvent(const recorderLogRecord_t *pRecord)
+{
+	unsigned int head = atomic_load_explicit(&eventHead, memory_order_relaxed);
+	if (head - atomic_load_explicit(&eventTail, memory_order_acquire) == RECORDER_RING_EVENTS) {
+		droppedEvents++;
+		return;
+	}
+	ringEvents[head % RECORDER_RING_EVENTS] = *pRecord;
+	atomic_store_explicit(&eventHead, head + 1, memory_order_release);
+}
+
+void Recorder_logTrigger(uint64_t frame, const triggerEvent_t *pEvent)
+{
+	recorderLogRecord_t record = {
+		.frame = frame,
+		.type = RECORDER_EVENT_TRIGGER,
+		.source = pEvent->source,
+		.sampleId = pEvent->sampleId,
+		.velocity = pEvent->velocity,
+		.pitch = pEvent->params.pitch,
+		.decayMs = pEvent->params.decayMs,
+		.pan = pEvent->params.pan,
+	};
+	pushEvent(&record);
+}
+
+void Recorder_logMasterGain(uint64_t frame, int gainPercent)
+{
+	recorderLogRecord_t record = {
+		.frame = frame,
+		.type = RECORDER_EVENT_MASTER_GAIN,
+		.value = gainPercent,
+	};
+	pushEvent(&record);
+}
+
+bool Recorder_openWav(const char *wavPath, int sampleRate, int numChannels)
+{
+	if (!openChunkWriter(&offlineWriter, wavPath)) {
+		return false;
+	}
+	offlineChannels = numChannels;
+	offlineSampleRate = sampleRate;
+	uint8_t wavHeader[WAV_HEADER_BYTES];
+	fillWavHeader(wavHeader, numChannels, sampleRate, 0);
+	appendChunkWriter(&offlineWriter, wavHeader, sizeof(wavHeader));
+	return true;
+}
+
+void Recorder_appendWav(const short *pSamples, int frames)
+{
+	appendChunkWriter(&offlineWriter, pSamples, frames * offlineChannels * sizeof(short));
+}
+
+void Recorder_closeWav(void)
+{
+	finishWav(&offlineWriter, offlineChannels, offlineSampleRate);
+}
+
+bool Recorder_replay(const char *logPath, const char *wavPath)
+{
+	FILE *logFile = fopen(logPath, "rb");
+	if (logFile == NULL) {
+		fprintf(stderr, "ERROR: Unable to open trigger log %s.\n", logPath);
+		return false;
+	}
+	recorderLogHeader_t header;
+	if (fread(&header, sizeof(header), 1, logFile) != 1
+			|| memcmp(header.magic, RECORDER_LOG_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != RECORDER_LOG_VERSION) {
+		fprintf(stderr, "ERROR: %s is not a trigger log.\n", logPath);
+		fclose(logFile);
+		return false;
+	}
+
+	TriggerBus_init();
+	AudioMixer_initOffline(header.periodFrames);
+	if ((uint32_t) AudioMixer_getNumChannels() != header.numChannels) {
+		fprintf(stderr, "ERROR: Log has %u channels, mixer has %d.\n",
+				header.numChannels, AudioMixer_getNumChannels());
+		AudioMixer_cleanup();
+		fclose(logFile);
+		return false;
+	}
+	if (!Recorder_openWav(wavPath, header.sampleRate, header.numChannels)) {
+		AudioMixer_cleanup();
+		fclose(logFile);
+		return false;
+	}
+
+	short *period = malloc(header.periodFrames * header.numChannels * sizeof(short));
+	recorderLogRecord_t record;
+	bool haveRecord = fread(&record, sizeof(record), 1, logFile) == 1;
+	uint64_t endFrame = UINT64_MAX;
+	for (uint64_t frame = 0; frame < endFrame; frame += header.periodFrames) {
+		// Everything logged at this frame was applied before the period was mixed.
+		while (haveRecord && record.frame <= frame && endFrame == UINT64_MAX) {
+			if (record.type == RECORDER_EVENT_TRIGGER) {
+				triggerParams_t params = {
+					.pan = record.pan,
+					.pitch = record.pitch,
+					.decayMs = record.decayMs,
+				};
+				TriggerBus_postWithParams(record.source, record.sampleId, record.velocity, &params);
+			} else if (record.type == RECORDER_EVENT_MASTER_GAIN) {
+				AudioMixer_setMasterGain(record.value);
+			} else if (record.type == RECORDER_EVENT_END) {
+				endFrame = record.frame;
+			}
+			haveRecord = fread(&record, sizeof(record), 1, logFile) == 1;
+		}
+		if (!haveRecord && endFrame == UINT64_MAX) {
+			fprintf(stderr, "Recorder: %s is truncated, replay stops at frame %llu\n",
+					logPath, (unsigned long long) frame);
+			break;
+		}
+		if (frame >= endFrame) {
+			break;
+		}
+		AudioMixer_renderPeriod(period);
+		Recorder_appendWav(period, header.periodFrames);
+	}
+
+	free(period);
+	fclose(logFile);
+	Recorder_closeWav();
+	AudioMixer_cleanup();
+	return true;
+}
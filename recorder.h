@@ -0,0 +1,76 @@
+// Session recorder: captures the mixed output to a WAV file and every
+// trigger the mixer consumed to a binary log, without doing any I/O on the
+// playback thread. The playback thread copies each period into a
+// preallocated lock-free ring; a low-priority writer thread drains it.
+// Replaying the log through the mixer reproduces the WAV bit-exactly.
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "triggerBus.h"
+
+// Periods the ring can hold before the writer falls behind (~3 s at 50 ms).
+#define RECORDER_RING_PERIODS 64
+#define RECORDER_RING_EVENTS 1024
+
+#define RECORDER_LOG_MAGIC "BBTL"
+#define RECORDER_LOG_VERSION 3
+
+typedef enum {
+	RECORDER_EVENT_TRIGGER,
+	RECORDER_EVENT_MASTER_GAIN,
+	RECORDER_EVENT_END,
+} recorderEventType_t;
+
+// On-disk layout of the trigger log: one header, then 24-byte records.
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t sampleRate;
+	uint32_t numChannels;
+	uint32_t periodFrames;
+	uint32_t reserved;
+} recorderLogHeader_t;
+
+typedef struct {
+	uint64_t frame;		// output frame at which the event took effect
+	uint8_t type;		// recorderEventType_t
+	uint8_t source;		// triggerSource_t, for triggers
+	uint8_t sampleId;
+	uint8_t velocity;
+	int32_t value;		// gain percent for RECORDER_EVENT_MASTER_GAIN
+	uint16_t pitch;		// trigger voice parameters, see triggerParams_t
+	uint16_t decayMs;
+	uint8_t pan;
+	uint8_t reserved[3];
+} recorderLogRecord_t;
+
+// Start recording to wavPath and logPath. Must be called before the mixer
+// starts producing audio so the log covers every voice in the recording.
+bool Recorder_start(const char *wavPath, const char *logPath,
+		int sampleRate, int numChannels, int periodFrames);
+// Flush everything, finish the WAV header and print the recorder's cost.
+void Recorder_stop(void);
+bool Recorder_isActive(void);
+// Wait until the writer has drained the rings to half full. For offline
+// renderers that produce periods faster than real time; never call it
+// from the playback thread.
+void Recorder_waitForWriter(void);
+
+// Called by the mixer on the playback thread; never block.
+void Recorder_writePeriod(const short *pSamples, int frames);
+void Recorder_logTrigger(uint64_t frame, const triggerEvent_t *pEvent);
+void Recorder_logMasterGain(uint64_t frame, int gainPercent);
+
+// Synchronous WAV output for offline rendering (replay and the simulator);
+// one file at a time, independent of Recorder_start().
+bool Recorder_openWav(const char *wavPath, int sampleRate, int numChannels);
+void Recorder_appendWav(const short *pSamples, int frames);
+void Recorder_closeWav(void);
+
+// Render logPath through the mixer offline into wavPath. The samples the
+// log refers to must already be registered with the mixer.
+bool Recorder_replay(const char *logPath, const char *wavPath);
+
+#endif
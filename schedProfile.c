@@ -0,0 +1,100 @@
+#include "schedProfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BITS_PER_MASK ((int) (sizeof(unsigned long) * 8))
+
+static const char *roleNames[THREAD_ROLE_COUNT] = {
+	"audio",
+	"mix-worker",
+	"sensor",
+	"input",
+	"network",
+	"background",
+};
+
+static int getNumCpus(void)
+{
+	long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numCpus < 1) {
+		return 1;
+	}
+	if (numCpus > BITS_PER_MASK) {
+		return BITS_PER_MASK;
+	}
+	return numCpus;
+}
+
+void SchedProfile_getNormal(schedProfile_t *pProfile)
+{
+	pProfile->name = "normal";
+	for (int i = 0; i < THREAD_ROLE_COUNT; i++) {
+		pProfile->roles[i].cpuMask = 0;
+		pProfile->roles[i].priority = 0;
+		pProfile->roles[i].nice = 0;
+	}
+}
+
+void SchedProfile_getFloating(schedProfile_t *pProfile)
+{
+	SchedProfile_getNormal(pProfile);
+	pProfile->name = "float";
+	pProfile->roles[THREAD_ROLE_BACKGROUND].nice = SCHEDPROFILE_BACKGROUND_NICE;
+	pProfile->roles[THREAD_ROLE_AUDIO].priority = SCHEDPROFILE_AUDIO_PRIORITY;
+	pProfile->roles[THREAD_ROLE_MIX_WORKER].priority = SCHEDPROFILE_AUDIO_PRIORITY;
+}
+
+bool SchedProfile_getPinned(schedProfile_t *pProfile, int audioCpu)
+{
+	int numCpus = getNumCpus();
+	SchedProfile_getFloating(pProfile);
+	// Nothing to isolate on a single core.
+	if (numCpus < 2 || audioCpu < 0 || audioCpu >= numCpus) {
+		fprintf(stderr, "SchedProfile: Cannot reserve CPU %d of %d, threads will float\n",
+				audioCpu, numCpus);
+		return false;
+	}
+	pProfile->name = "pinned";
+
+	unsigned long allCpus = (numCpus == BITS_PER_MASK) ? ~0UL : (1UL << numCpus) - 1;
+	unsigned long audioMask = 1UL << audioCpu;
+	for (int i = 0; i < THREAD_ROLE_COUNT; i++) {
+		pProfile->roles[i].cpuMask = allCpus & ~audioMask;
+	}
+	pProfile->roles[THREAD_ROLE_AUDIO].cpuMask = audioMask;
+	pProfile->roles[THREAD_ROLE_AUDIO].priority = SCHEDPROFILE_PINNED_AUDIO_PRIORITY;
+	pProfile->roles[THREAD_ROLE_MIX_WORKER].priority = SCHEDPROFILE_PINNED_AUDIO_PRIORITY;
+	return true;
+}
+
+void SchedProfile_fromEnvironment(schedProfile_t *pProfile)
+{
+	const char *profileName = getenv("BEATBOX_SCHED_PROFILE");
+	if (profileName == NULL || strcmp(profileName, "float") == 0) {
+		SchedProfile_getFloating(pProfile);
+		return;
+	}
+	if (strcmp(profileName, "normal") == 0) {
+		SchedProfile_getNormal(pProfile);
+		return;
+	}
+	if (strcmp(profileName, "pinned") != 0) {
+		fprintf(stderr, "SchedProfile: Unknown profile %s, using float\n", profileName);
+		SchedProfile_getFloating(pProfile);
+		return;
+	}
+
+	int audioCpu = getNumCpus() - 1;
+	const char *audioCpuText = getenv("BEATBOX_AUDIO_CPU");
+	if (audioCpuText != NULL) {
+		audioCpu = atoi(audioCpuText);
+	}
+	SchedProfile_getPinned(pProfile, audioCpu);
+}
+
+const char *SchedProfile_getRoleName(threadRole_t role)
+{
+	return roleNames[role];
+}
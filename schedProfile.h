@@ -0,0 +1,57 @@
+// Scheduling profiles: which CPUs and priority each kind of thread gets.
+// "normal" leaves every thread time-shared and unpinned, a baseline to
+// compare the others against; "float" lets every thread run anywhere but
+// gives the audio mixer real-time priority (what a single-core BeagleBone
+// needs); "pinned" also gives the mixer a core of its own and keeps every
+// other thread off that core. Parallel mix workers share the audio
+// priority.
+#ifndef SCHED_PROFILE_H
+#define SCHED_PROFILE_H
+
+#include <stdbool.h>
+
+typedef enum {
+	THREAD_ROLE_AUDIO,
+	THREAD_ROLE_MIX_WORKER,
+	THREAD_ROLE_SENSOR,
+	THREAD_ROLE_INPUT,
+	THREAD_ROLE_NETWORK,
+	THREAD_ROLE_BACKGROUND,
+	THREAD_ROLE_COUNT
+} threadRole_t;
+
+// A cpuMask of 0 lets the thread float; a priority of 0 is the normal
+// time-shared policy, 1 - 99 is SCHED_FIFO. nice (0 - 19) lowers a
+// time-shared thread below the others.
+typedef struct {
+	unsigned long cpuMask;
+	int priority;
+	int nice;
+} schedRoleConfig_t;
+
+typedef struct {
+	const char *name;
+	schedRoleConfig_t roles[THREAD_ROLE_COUNT];
+} schedProfile_t;
+
+#define SCHEDPROFILE_AUDIO_PRIORITY 50
+#define SCHEDPROFILE_PINNED_AUDIO_PRIORITY 80
+// Background threads (recorder writer, log flusher, status printing) can
+// run late without anyone hearing it.
+#define SCHEDPROFILE_BACKGROUND_NICE 10
+
+void SchedProfile_getNormal(schedProfile_t *pProfile);
+void SchedProfile_getFloating(schedProfile_t *pProfile);
+// audioCpu is the core reserved for the mixer, ideally one removed from
+// the general scheduler with the isolcpus= kernel parameter. Returns false
+// and gives the float profile if there is no such core to reserve.
+bool SchedProfile_getPinned(schedProfile_t *pProfile, int audioCpu);
+
+// Select a profile from the environment:
+//   BEATBOX_SCHED_PROFILE=normal|float|pinned   (default float)
+//   BEATBOX_AUDIO_CPU=<n>                (default: last online CPU)
+void SchedProfile_fromEnvironment(schedProfile_t *pProfile);
+
+const char *SchedProfile_getRoleName(threadRole_t role);
+
+#endif
@@ -0,0 +1,313 @@
+#include "simulator.h"
+#include "audioMixer_template.h"
+#include "triggerBus.h"
+#include "recorder.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SECOND 1000000000ULL
+#define NEVER UINT64_MAX
+#define MAX_LINE 1024
+#define NUM_AXES 3
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef enum {
+	SIM_EVENT_HIT,
+	SIM_EVENT_BUTTON,
+	SIM_EVENT_UDP,
+	SIM_EVENT_END,
+} simEventType_t;
+
+typedef struct {
+	uint64_t timeMs;
+	int line;				// keeps script order for events at the same time
+	simEventType_t type;
+	int target;				// axis or joystick direction
+	int holdMs;
+	char *pText;			// UDP payload
+} simEvent_t;
+
+// Polled inputs, in the order they run when due at the same time.
+typedef enum {
+	TASK_ACCEL_X,
+	TASK_ACCEL_Y,
+	TASK_ACCEL_Z,
+	TASK_JOYSTICK,
+	TASK_STATUS,
+	TASK_COUNT
+} simTask_t;
+
+static const char *axisNames[NUM_AXES] = {"x", "y", "z"};
+static const char *directionNames[JOYSTICK_NUM_DIRECTIONS] = {
+	"up", "down", "left", "right", "push",
+};
+static const int16_t restReadings[NUM_AXES] = {0, 0, SIMULATOR_GRAVITY_READING};
+
+static simEvent_t *events = NULL;
+static int numEvents = 0;
+static uint64_t sessionMs = 0;
+
+static uint64_t taskDueNs[TASK_COUNT];
+static uint64_t hitUntilNs[NUM_AXES];
+static uint64_t pressedUntilNs[JOYSTICK_NUM_DIRECTIONS];
+
+static uint64_t nowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static int findName(const char *name, const char **names, int count)
+{
+	for (int i = 0; i < count; i++) {
+		if (strcmp(name, names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int compareEvents(const void *pA, const void *pB)
+{
+	const simEvent_t *a = pA;
+	const simEvent_t *b = pB;
+	if (a->timeMs != b->timeMs) {
+		return (a->timeMs > b->timeMs) - (a->timeMs < b->timeMs);
+	}
+	return a->line - b->line;
+}
+
+static bool parseLine(char *line, int lineNumber, simEvent_t *pEvent)
+{
+	char *comment = strchr(line, '#');
+	if (comment != NULL) {
+		*comment = '\0';
+	}
+	unsigned long long timeMs;
+	char name[32];
+	int consumed = 0;
+	if (sscanf(line, " %llu %31s %n", &timeMs, name, &consumed) < 2) {
+		return false;
+	}
+	char *args = line + consumed;
+	args[strcspn(args, "\r\n")] = '\0';
+	pEvent->timeMs = timeMs;
+	pEvent->line = lineNumber;
+	pEvent->holdMs = SIMULATOR_DEFAULT_HOLD_MS;
+	pEvent->pText = NULL;
+
+	char target[32] = "";
+	sscanf(args, "%31s %d", target, &pEvent->holdMs);
+	if (strcmp(name, "hit") == 0) {
+		pEvent->type = SIM_EVENT_HIT;
+		pEvent->target = findName(target, axisNames, NUM_AXES);
+	} else if (strcmp(name, "button") == 0) {
+		pEvent->type = SIM_EVENT_BUTTON;
+		pEvent->target = findName(target, directionNames, JOYSTICK_NUM_DIRECTIONS);
+	} else if (strcmp(name, "udp") == 0) {
+		pEvent->type = SIM_EVENT_UDP;
+		pEvent->target = 0;
+		pEvent->pText = strdup(args);
+	} else if (strcmp(name, "end") == 0) {
+		pEvent->type = SIM_EVENT_END;
+		pEvent->target = 0;
+	} else {
+		pEvent->target = -1;
+	}
+	if (pEvent->target < 0) {
+		fprintf(stderr, "Simulator: Ignoring line %d, unknown event \"%s %s\"\n",
+				lineNumber, name, target);
+		return false;
+	}
+	return true;
+}
+
+static bool loadScript(const char *scriptPath)
+{
+	FILE *pFile = fopen(scriptPath, "r");
+	if (pFile == NULL) {
+		fprintf(stderr, "ERROR: Unable to open simulation script %s.\n", scriptPath);
+		return false;
+	}
+	int capacity = 0;
+	bool haveEnd = false;
+	uint64_t lastMs = 0;
+	char line[MAX_LINE];
+	numEvents = 0;
+	for (int lineNumber = 1; fgets(line, sizeof(line), pFile) != NULL; lineNumber++) {
+		simEvent_t event;
+		if (!parseLine(line, lineNumber, &event)) {
+			continue;
+		}
+		if (event.type == SIM_EVENT_END) {
+			sessionMs = event.timeMs;
+			haveEnd = true;
+			continue;
+		}
+		if (numEvents == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			events = realloc(events, capacity * sizeof(*events));
+		}
+		events[numEvents++] = event;
+		if (event.timeMs > lastMs) {
+			lastMs = event.timeMs;
+		}
+	}
+	fclose(pFile);
+	if (!haveEnd) {
+		sessionMs = lastMs + SIMULATOR_DEFAULT_TAIL_MS;
+	}
+	qsort(events, numEvents, sizeof(*events), compareEvents);
+	return true;
+}
+
+static void freeScript(void)
+{
+	for (int i = 0; i < numEvents; i++) {
+		free(events[i].pText);
+	}
+	free(events);
+	events = NULL;
+	numEvents = 0;
+}
+
+// Returns true if the event asked the program to shut down.
+static bool applyEvent(const simEvent_t *pEvent, uint64_t timeNs, threadController *pController)
+{
+	char reply[100];
+	switch (pEvent->type) {
+	case SIM_EVENT_HIT:
+		hitUntilNs[pEvent->target] = timeNs + SIMULATOR_HIT_MS * NS_PER_MS;
+		break;
+	case SIM_EVENT_BUTTON:
+		pressedUntilNs[pEvent->target] = timeNs + pEvent->holdMs * NS_PER_MS;
+		break;
+	case SIM_EVENT_UDP:
+		LOG_INFO("Got message %s", pEvent->pText);
+		return processCommand(pController, pEvent->pText, reply, sizeof(reply));
+	case SIM_EVENT_END:
+		break;
+	}
+	return false;
+}
+
+static void runTask(simTask_t task, uint64_t timeNs, threadController *pController)
+{
+	long long waitMs;
+	if (task <= TASK_ACCEL_Z) {
+		int axis = task - TASK_ACCEL_X;
+		int16_t reading = (timeNs < hitUntilNs[axis]) ? SIMULATOR_HIT_READING : restReadings[axis];
+		waitMs = accelerometerStep(pController, TRIGGER_SOURCE_ACCEL_X + axis, reading);
+	} else if (task == TASK_JOYSTICK) {
+		bool pressed[JOYSTICK_NUM_DIRECTIONS];
+		for (int i = 0; i < JOYSTICK_NUM_DIRECTIONS; i++) {
+			pressed[i] = timeNs < pressedUntilNs[i];
+		}
+		waitMs = joystickStep(pController, pressed);
+	} else {
+		printStatus(pController);
+		waitMs = STATUS_INTERVAL_MS;
+	}
+	taskDueNs[task] = timeNs + waitMs * NS_PER_MS;
+}
+
+static void hashSamples(uint64_t *pHash, const short *pSamples, int count)
+{
+	const unsigned char *pBytes = (const unsigned char *) pSamples;
+	for (size_t i = 0; i < count * sizeof(short); i++) {
+		*pHash = (*pHash ^ pBytes[i]) * FNV_PRIME;
+	}
+}
+
+bool Simulator_run(const char *scriptPath, const char *wavPath, int repeats,
+		threadController *pController, simulatorResult_t *pResult)
+{
+	if (!loadScript(scriptPath)) {
+		return false;
+	}
+	int numChannels = AudioMixer_getNumChannels();
+	int sampleRate = AudioMixer_getSampleRate();
+	if (wavPath != NULL && !Recorder_openWav(wavPath, sampleRate, numChannels)) {
+		freeScript();
+		return false;
+	}
+	TriggerBus_init();
+	setMixWorkersFromEnvironment();
+	AudioMixer_initOffline(SIMULATOR_PERIOD_FRAMES);
+	// Recording works as in a live session, so a replay can be checked against it.
+	startSessionRecording();
+	short *pPeriod = malloc(SIMULATOR_PERIOD_FRAMES * numChannels * sizeof(*pPeriod));
+	for (int i = 0; i < TASK_COUNT; i++) {
+		taskDueNs[i] = 0;
+	}
+	memset(hitUntilNs, 0, sizeof(hitUntilNs));
+	memset(pressedUntilNs, 0, sizeof(pressedUntilNs));
+	memset(pResult, 0, sizeof(*pResult));
+	pResult->audioHash = FNV_OFFSET_BASIS;
+
+	uint64_t wallStart = nowNs();
+	uint64_t endNs = sessionMs * repeats * NS_PER_MS;
+	int nextEvent = 0;
+	int repeat = 0;
+	uint64_t frame = 0;
+	for (uint64_t periodNs = 0; periodNs < endNs;
+			frame += SIMULATOR_PERIOD_FRAMES,
+			periodNs = frame * NS_PER_SECOND / sampleRate) {
+		// Everything that happened up to the start of a period is heard in it,
+		// as when the playback thread drains the trigger bus.
+		for (;;) {
+			uint64_t eventNs = NEVER;
+			if (repeat < repeats && nextEvent < numEvents) {
+				eventNs = (repeat * sessionMs + events[nextEvent].timeMs) * NS_PER_MS;
+			}
+			simTask_t task = TASK_ACCEL_X;
+			for (int i = 1; i < TASK_COUNT; i++) {
+				if (taskDueNs[i] < taskDueNs[task]) {
+					task = i;
+				}
+			}
+			if (eventNs <= periodNs && eventNs <= taskDueNs[task]) {
+				if (applyEvent(&events[nextEvent], eventNs, pController)) {
+					pResult->shutdownRequested = true;
+					endNs = eventNs;
+				}
+				if (++nextEvent == numEvents) {
+					nextEvent = 0;
+					repeat++;
+				}
+			} else if (taskDueNs[task] <= periodNs) {
+				runTask(task, taskDueNs[task], pController);
+			} else {
+				break;
+			}
+		}
+		if (pResult->shutdownRequested) {
+			break;
+		}
+		AudioMixer_renderPeriod(pPeriod);
+		hashSamples(&pResult->audioHash, pPeriod, SIMULATOR_PERIOD_FRAMES * numChannels);
+		if (wavPath != NULL) {
+			Recorder_appendWav(pPeriod, SIMULATOR_PERIOD_FRAMES);
+		}
+		// The recorder's writer runs on the wall clock; keep it from falling behind.
+		Recorder_waitForWriter();
+	}
+
+	pResult->wallNs = nowNs() - wallStart;
+	pResult->frames = frame;
+	pResult->simulatedMs = frame * 1000 / sampleRate;
+	pResult->triggers = TriggerBus_getPostedCount();
+	free(pPeriod);
+	AudioMixer_cleanup();
+	if (wavPath != NULL) {
+		Recorder_closeWav();
+	}
+	freeScript();
+	return true;
+}
@@ -0,0 +1,45 @@
+// Full-system simulator: runs the beatbox's sensor, joystick, UDP and
+// audio logic in one thread against a simulated clock, with no hardware.
+// A script says what happens when; the accelerometer and joystick are
+// polled on the same schedule as on the board and the mixer renders each
+// period offline, so a session is deterministic and runs as fast as the
+// host can mix it.
+//
+// Script lines are "<ms> <event>", times in simulated milliseconds from the
+// start of the session, in any order; '#' starts a comment:
+//   250 hit x                 swing along an axis (x, y or z)
+//   900 button push [holdMs]  hold a joystick direction (up, down, left,
+//                             right, push), 100 ms by default
+//   1200 udp sound2 pan=10    a UDP command packet, as sent to port 12345
+//   5000 end                  length of the session (default: last event + 1 s)
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "functions.h"
+
+#define SIMULATOR_PERIOD_FRAMES 512
+// How long a swing reads near full scale, and the readings at rest.
+#define SIMULATOR_HIT_MS 20
+#define SIMULATOR_HIT_READING 32767
+#define SIMULATOR_GRAVITY_READING 16384
+#define SIMULATOR_DEFAULT_HOLD_MS 100
+#define SIMULATOR_DEFAULT_TAIL_MS 1000
+
+typedef struct {
+	uint64_t simulatedMs;
+	uint64_t wallNs;
+	uint64_t frames;
+	uint64_t audioHash;		// FNV-1a over the rendered samples
+	unsigned long triggers;
+	bool shutdownRequested;	// a "shutdown" command ended the session early
+} simulatorResult_t;
+
+// Play the script repeats times back to back. The samples the session uses
+// must already be registered with the mixer. wavPath may be NULL to only
+// hash the audio. Returns false if the script cannot be read.
+bool Simulator_run(const char *scriptPath, const char *wavPath, int repeats,
+		threadController *pController, simulatorResult_t *pResult);
+
+#endif
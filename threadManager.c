@@ -0,0 +1,323 @@
+// Shutdown is broadcast two ways: a condition variable for threads that
+// sleep, and an eventfd for threads blocked on a file descriptor.
+#define _GNU_SOURCE
+#include "threadManager.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_SECOND 1000000000LL
+
+typedef struct {
+	char name[16];
+	threadRole_t role;
+	void *(*function)(void *);
+	void *arg;
+	pthread_t id;
+} managedThread_t;
+
+// Every configured thread, spawned here or not, for CPU time reporting.
+typedef struct {
+	char name[16];
+	threadRole_t role;
+	pid_t tid;
+	bool exited;
+	unsigned long userTicks;
+	unsigned long systemTicks;
+	int lastCpu;
+} threadStats_t;
+
+static managedThread_t threads[THREADMANAGER_MAX_THREADS];
+static int numThreads = 0;
+static threadStats_t stats[THREADMANAGER_MAX_THREADS];
+static atomic_int numStats = 0;
+static pthread_key_t statsKey;
+static pthread_once_t statsKeyOnce = PTHREAD_ONCE_INIT;
+static atomic_bool initialized = false;
+static schedProfile_t profile;
+
+static atomic_bool running = false;
+static pthread_mutex_t shutdownMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shutdownCond;
+static int shutdownFd = -1;
+static long long shutdownRequestedNs = 0;
+
+static long long getTimeNs(clockid_t clock)
+{
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static struct timespec toTimespec(long long timeNs)
+{
+	struct timespec ts = {timeNs / NS_PER_SECOND, timeNs % NS_PER_SECOND};
+	return ts;
+}
+
+static bool readCpuTimes(threadStats_t *pStats);
+
+// Runs as each configured thread exits, while its /proc entry still exists.
+static void recordExit(void *arg)
+{
+	threadStats_t *pStats = arg;
+	readCpuTimes(pStats);
+	pStats->exited = true;
+}
+
+static void createStatsKey(void)
+{
+	pthread_key_create(&statsKey, recordExit);
+}
+
+void ThreadManager_init(const schedProfile_t *pProfile)
+{
+	profile = *pProfile;
+	atomic_store(&numStats, 0);
+	// init() runs again for every benchmark; the key is process-wide.
+	pthread_once(&statsKeyOnce, createStatsKey);
+
+	pthread_condattr_t condAttr;
+	pthread_condattr_init(&condAttr);
+	pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+	pthread_cond_init(&shutdownCond, &condAttr);
+	pthread_condattr_destroy(&condAttr);
+
+	shutdownFd = eventfd(0, EFD_CLOEXEC);
+	if (shutdownFd < 0) {
+		perror("ThreadManager: Unable to create shutdown eventfd");
+	}
+	numThreads = 0;
+	atomic_store(&running, true);
+	atomic_store(&initialized, true);
+}
+
+void ThreadManager_configureCurrentThread(const char *name, threadRole_t role)
+{
+	pthread_t self = pthread_self();
+	pthread_setname_np(self, name);
+
+	// Offline tools start the mixer's threads without a thread manager;
+	// they have no stats key to register with and no profile to apply.
+	if (!atomic_load(&initialized)) {
+		return;
+	}
+	int statsIndex = atomic_fetch_add(&numStats, 1);
+	if (statsIndex < THREADMANAGER_MAX_THREADS) {
+		threadStats_t *pStats = &stats[statsIndex];
+		snprintf(pStats->name, sizeof(pStats->name), "%s", name);
+		pStats->role = role;
+		pStats->tid = syscall(SYS_gettid);
+		pStats->exited = false;
+		pthread_setspecific(statsKey, pStats);
+	}
+
+	const schedRoleConfig_t *config = &profile.roles[role];
+	if (config->cpuMask != 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int cpu = 0; cpu < (int) (sizeof(config->cpuMask) * 8); cpu++) {
+			if (config->cpuMask & (1UL << cpu)) {
+				CPU_SET(cpu, &cpus);
+			}
+		}
+		int err = pthread_setaffinity_np(self, sizeof(cpus), &cpus);
+		if (err != 0) {
+			fprintf(stderr, "ThreadManager: Unable to pin %s to CPUs 0x%lx: %s\n",
+					name, config->cpuMask, strerror(err));
+		}
+	}
+
+	if (config->priority != 0) {
+		struct sched_param param = {.sched_priority = config->priority};
+		int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+		if (err != 0) {
+			fprintf(stderr, "ThreadManager: Unable to give %s priority %d: %s\n",
+					name, config->priority, strerror(err));
+		}
+	}
+
+	// On Linux a thread id names just that thread.
+	if (config->nice != 0
+			&& setpriority(PRIO_PROCESS, syscall(SYS_gettid), config->nice) != 0) {
+		fprintf(stderr, "ThreadManager: Unable to give %s nice %d: %s\n",
+				name, config->nice, strerror(errno));
+	}
+}
+
+static void *startThread(void *arg)
+{
+	managedThread_t *thread = arg;
+	ThreadManager_configureCurrentThread(thread->name, thread->role);
+	return thread->function(thread->arg);
+}
+
+bool ThreadManager_spawn(const char *name, threadRole_t role,
+		void *(*function)(void *), void *arg)
+{
+	if (numThreads == THREADMANAGER_MAX_THREADS) {
+		fprintf(stderr, "ThreadManager: Unable to start %s, too many threads\n", name);
+		return false;
+	}
+	managedThread_t *thread = &threads[numThreads];
+	snprintf(thread->name, sizeof(thread->name), "%s", name);
+	thread->function = function;
+	thread->arg = arg;
+	thread->role = role;
+
+	int err = pthread_create(&thread->id, NULL, startThread, thread);
+	if (err != 0) {
+		fprintf(stderr, "ThreadManager: Unable to start %s: %s\n", name, strerror(err));
+		return false;
+	}
+	numThreads++;
+	return true;
+}
+
+void ThreadManager_requestShutdown(void)
+{
+	pthread_mutex_lock(&shutdownMutex);
+	bool wasRunning = atomic_exchange(&running, false);
+	if (wasRunning) {
+		shutdownRequestedNs = getTimeNs(CLOCK_MONOTONIC);
+	}
+	pthread_cond_broadcast(&shutdownCond);
+	pthread_mutex_unlock(&shutdownMutex);
+
+	if (wasRunning && shutdownFd >= 0) {
+		uint64_t one = 1;
+		if (write(shutdownFd, &one, sizeof(one)) != sizeof(one)) {
+			perror("ThreadManager: Unable to signal shutdown eventfd");
+		}
+	}
+}
+
+bool ThreadManager_isRunning(void)
+{
+	return atomic_load(&running);
+}
+
+bool ThreadManager_sleepMs(long long delayInMs)
+{
+	struct timespec wakeTime = toTimespec(getTimeNs(CLOCK_MONOTONIC) + delayInMs * NS_PER_MS);
+	pthread_mutex_lock(&shutdownMutex);
+	int err = 0;
+	while (atomic_load(&running) && err != ETIMEDOUT) {
+		err = pthread_cond_timedwait(&shutdownCond, &shutdownMutex, &wakeTime);
+	}
+	pthread_mutex_unlock(&shutdownMutex);
+	return atomic_load(&running);
+}
+
+void ThreadManager_waitForShutdown(void)
+{
+	pthread_mutex_lock(&shutdownMutex);
+	while (atomic_load(&running)) {
+		pthread_cond_wait(&shutdownCond, &shutdownMutex);
+	}
+	pthread_mutex_unlock(&shutdownMutex);
+}
+
+int ThreadManager_getShutdownFd(void)
+{
+	return shutdownFd;
+}
+
+bool ThreadManager_joinAll(long long timeoutMs)
+{
+	// pthread_timedjoin_np() takes a CLOCK_REALTIME deadline.
+	struct timespec deadline = toTimespec(getTimeNs(CLOCK_REALTIME) + timeoutMs * NS_PER_MS);
+	bool allJoined = true;
+	for (int i = 0; i < numThreads; i++) {
+		int err = pthread_timedjoin_np(threads[i].id, NULL, &deadline);
+		if (err != 0) {
+			fprintf(stderr, "ThreadManager: %s did not stop within %lld ms\n",
+					threads[i].name, timeoutMs);
+			// It releases itself if it ever stops; the caller keeps its
+			// argument alive.
+			pthread_detach(threads[i].id);
+			allJoined = false;
+		}
+	}
+	if (shutdownRequestedNs != 0) {
+		printf("Shutdown took %lld ms\n",
+				(getTimeNs(CLOCK_MONOTONIC) - shutdownRequestedNs) / NS_PER_MS);
+	}
+	// A thread that failed to stop may still be polling the eventfd.
+	if (allJoined && shutdownFd >= 0) {
+		close(shutdownFd);
+		shutdownFd = -1;
+	}
+	numThreads = 0;
+	return allJoined;
+}
+
+// Fields 14 and 15 of /proc/<pid>/task/<tid>/stat are user and system time
+// in clock ticks, field 39 is the CPU the thread last ran on.
+static bool readCpuTimes(threadStats_t *pStats)
+{
+	char path[64];
+	char line[1024];
+	snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int) pStats->tid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+	char *result = fgets(line, sizeof(line), file);
+	fclose(file);
+	if (result == NULL) {
+		return false;
+	}
+
+	// The thread name in field 2 may contain spaces, so count from its ')'.
+	char *field = strrchr(line, ')');
+	if (field == NULL) {
+		return false;
+	}
+	int fieldNumber = 2;
+	char *savePtr = NULL;
+	for (field = strtok_r(field + 1, " ", &savePtr); field != NULL;
+			field = strtok_r(NULL, " ", &savePtr)) {
+		fieldNumber++;
+		if (fieldNumber == 14) {
+			pStats->userTicks = strtoul(field, NULL, 10);
+		} else if (fieldNumber == 15) {
+			pStats->systemTicks = strtoul(field, NULL, 10);
+		} else if (fieldNumber == 39) {
+			pStats->lastCpu = atoi(field);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadManager_reportCpuTimes(void)
+{
+	long msPerTick = 1000 / sysconf(_SC_CLK_TCK);
+	int count = atomic_load(&numStats);
+	if (count > THREADMANAGER_MAX_THREADS) {
+		count = THREADMANAGER_MAX_THREADS;
+	}
+	printf("Thread CPU time (profile %s):\n", profile.name);
+	for (int i = 0; i < count; i++) {
+		threadStats_t *pStats = &stats[i];
+		if (!pStats->exited && !readCpuTimes(pStats)) {
+			continue;
+		}
+		printf("  %-15s %-10s user %6lu ms  sys %6lu ms  last cpu %d\n",
+				pStats->name, SchedProfile_getRoleName(pStats->role),
+				pStats->userTicks * msPerTick, pStats->systemTicks * msPerTick,
+				pStats->lastCpu);
+	}
+}
@@ -0,0 +1,50 @@
+// Owns the lifetime of the application's threads: creates them with a name,
+// and the CPU affinity and priority the scheduling profile gives their role,
+// wakes every one of them on shutdown and joins them within a bounded time.
+#ifndef THREAD_MANAGER_H
+#define THREAD_MANAGER_H
+
+#include <stdbool.h>
+#include "schedProfile.h"
+
+#define THREADMANAGER_MAX_THREADS 16
+#define THREADMANAGER_SHUTDOWN_TIMEOUT_MS 1000
+
+// init() must be called before any other functions. The profile is copied.
+void ThreadManager_init(const schedProfile_t *pProfile);
+
+// Start a thread that is joined by ThreadManager_joinAll().
+// Returns false if the thread could not be created.
+bool ThreadManager_spawn(const char *name, threadRole_t role,
+		void *(*function)(void *), void *arg);
+
+// Apply a name and the role's affinity and priority to the calling thread,
+// for threads created and joined by another module (e.g. audio playback).
+// Only names the thread if init() has never been called.
+void ThreadManager_configureCurrentThread(const char *name, threadRole_t role);
+
+// Ask every thread to stop; wakes all threads blocked in sleepMs(),
+// waitForShutdown() or polling the shutdown fd. Safe to call more than once.
+void ThreadManager_requestShutdown(void);
+bool ThreadManager_isRunning(void);
+
+// Sleep that returns early once shutdown is requested.
+// Returns false if woken by shutdown.
+bool ThreadManager_sleepMs(long long delayInMs);
+void ThreadManager_waitForShutdown(void);
+
+// eventfd that becomes readable when shutdown is requested; add it to
+// poll() next to any blocking descriptor.
+int ThreadManager_getShutdownFd(void);
+
+// Join every spawned thread, giving up after timeoutMs in total.
+// Returns true if all threads exited in time. Threads that did not are
+// detached and may still be running, so anything passed to them as an
+// argument must then be left allocated.
+bool ThreadManager_joinAll(long long timeoutMs);
+
+// Print user and system CPU time of every configured thread, read from
+// /proc/self/task. Threads that have exited report their final totals.
+void ThreadManager_reportCpuTimes(void);
+
+#endif
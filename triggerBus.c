@@ -0,0 +1,124 @@
+// Bounded lock-free queue: each cell carries a sequence number telling
+// producers and the consumer whose turn it is to use the cell, so posting
+// never takes a lock and never blocks the posting thread.
+#include "triggerBus.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+
+#define CAPACITY_MASK (TRIGGERBUS_CAPACITY - 1)
+
+typedef struct {
+	atomic_size_t sequence;
+	triggerEvent_t event;
+} triggerCell_t;
+
+static triggerCell_t cells[TRIGGERBUS_CAPACITY];
+static atomic_size_t enqueuePos;
+static atomic_size_t dequeuePos;
+static atomic_ulong postedCount;
+static atomic_ulong overflowCount[TRIGGER_SOURCE_COUNT];
+
+static uint64_t getTimeNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void TriggerBus_init(void)
+{
+	for(size_t i = 0; i < TRIGGERBUS_CAPACITY; i++){
+		atomic_store(&cells[i].sequence, i);
+	}
+	atomic_store(&enqueuePos, 0);
+	atomic_store(&dequeuePos, 0);
+	atomic_store(&postedCount, 0);
+	for(int i = 0; i < TRIGGER_SOURCE_COUNT; i++){
+		atomic_store(&overflowCount[i], 0);
+	}
+}
+
+bool TriggerBus_post(triggerSource_t source, int sampleId, int velocity)
+{
+	const triggerParams_t defaultParams = {
+		.pan = TRIGGERBUS_CENTER_PAN,
+		.pitch = TRIGGERBUS_UNITY_PITCH,
+		.decayMs = 0,
+	};
+	return TriggerBus_postWithParams(source, sampleId, velocity, &defaultParams);
+}
+
+bool TriggerBus_postWithParams(triggerSource_t source, int sampleId, int velocity,
+		const triggerParams_t *pParams)
+{
+	if(source < 0 || source >= TRIGGER_SOURCE_COUNT
+			|| sampleId < 0 || sampleId >= TRIGGERBUS_MAX_SAMPLES){
+		return false;
+	}
+	if(velocity < 0){
+		velocity = 0;
+	} else if(velocity > TRIGGERBUS_MAX_VELOCITY){
+		velocity = TRIGGERBUS_MAX_VELOCITY;
+	}
+
+	triggerCell_t *cell;
+	size_t pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+	for(;;){
+		cell = &cells[pos & CAPACITY_MASK];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+		if(diff == 0){
+			if(atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		} else if(diff < 0){
+			atomic_fetch_add_explicit(&overflowCount[source], 1, memory_order_relaxed);
+			return false;
+		} else{
+			pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+		}
+	}
+
+	cell->event.timestampNs = getTimeNs();
+	cell->event.source = source;
+	cell->event.sampleId = sampleId;
+	cell->event.velocity = velocity;
+	cell->event.params = *pParams;
+	if(cell->event.params.pan > TRIGGERBUS_MAX_PAN){
+		cell->event.params.pan = TRIGGERBUS_MAX_PAN;
+	}
+	if(cell->event.params.pitch < TRIGGERBUS_MIN_PITCH){
+		cell->event.params.pitch = TRIGGERBUS_MIN_PITCH;
+	} else if(cell->event.params.pitch > TRIGGERBUS_MAX_PITCH){
+		cell->event.params.pitch = TRIGGERBUS_MAX_PITCH;
+	}
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+	atomic_fetch_add_explicit(&postedCount, 1, memory_order_relaxed);
+	return true;
+}
+
+bool TriggerBus_pop(triggerEvent_t *pEvent)
+{
+	size_t pos = atomic_load_explicit(&dequeuePos, memory_order_relaxed);
+	triggerCell_t *cell = &cells[pos & CAPACITY_MASK];
+	size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+	if(sequence != pos + 1){
+		return false;
+	}
+	*pEvent = cell->event;
+	atomic_store_explicit(&cell->sequence, pos + TRIGGERBUS_CAPACITY, memory_order_release);
+	atomic_store_explicit(&dequeuePos, pos + 1, memory_order_relaxed);
+	return true;
+}
+
+unsigned long TriggerBus_getPostedCount(void)
+{
+	return atomic_load(&postedCount);
+}
+
+unsigned long TriggerBus_getOverflowCount(triggerSource_t source)
+{
+	return atomic_load(&overflowCount[source]);
+}
@@ -0,0 +1,63 @@
+// Multi-producer event bus carrying drum triggers to the audio mixer.
+// Sensor and network threads post one event per hit; the mixer drains the
+// bus once per period, so repeated hits are never merged.
+#ifndef TRIGGER_BUS_H
+#define TRIGGER_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Capacity must be a power of two.
+#define TRIGGERBUS_CAPACITY 256
+// Sample ids must fit the event; the mixer drops ids nothing is registered for.
+#define TRIGGERBUS_MAX_SAMPLES 256
+#define TRIGGERBUS_MAX_VELOCITY 127
+#define TRIGGERBUS_MAX_PAN 127
+#define TRIGGERBUS_CENTER_PAN 64
+// Pitch is the playback rate in 1/256ths of the original.
+#define TRIGGERBUS_UNITY_PITCH 256
+#define TRIGGERBUS_MIN_PITCH (TRIGGERBUS_UNITY_PITCH / 4)
+#define TRIGGERBUS_MAX_PITCH (TRIGGERBUS_UNITY_PITCH * 4)
+
+typedef enum {
+	TRIGGER_SOURCE_ACCEL_X,
+	TRIGGER_SOURCE_ACCEL_Y,
+	TRIGGER_SOURCE_ACCEL_Z,
+	TRIGGER_SOURCE_NETWORK,
+	TRIGGER_SOURCE_COUNT
+} triggerSource_t;
+
+// How a voice is played; TriggerBus_post() uses centre pan, original
+// pitch and no decay.
+typedef struct {
+	uint8_t pan;			// 0 hard left, TRIGGERBUS_CENTER_PAN centre, 127 hard right
+	uint16_t pitch;			// TRIGGERBUS_MIN_PITCH - TRIGGERBUS_MAX_PITCH
+	uint16_t decayMs;		// fade to silence over this long, 0 plays the whole sample
+} triggerParams_t;
+
+typedef struct {
+	uint64_t timestampNs;	// CLOCK_MONOTONIC time the event was posted
+	uint8_t source;			// triggerSource_t
+	uint8_t sampleId;		// index registered with AudioMixer_registerSample()
+	uint8_t velocity;		// 0 - TRIGGERBUS_MAX_VELOCITY
+	triggerParams_t params;
+} triggerEvent_t;
+
+// init() must be called before any producer or consumer touches the bus.
+void TriggerBus_init(void);
+
+// Post a trigger; safe to call from any number of threads at once.
+// Returns false if the source or sample id is out of range, or if the bus
+// is full, which counts an overflow against the source.
+bool TriggerBus_post(triggerSource_t source, int sampleId, int velocity);
+bool TriggerBus_postWithParams(triggerSource_t source, int sampleId, int velocity,
+		const triggerParams_t *pParams);
+
+// Take the oldest event off the bus. Single consumer only (the mixer).
+// Returns false if the bus is empty.
+bool TriggerBus_pop(triggerEvent_t *pEvent);
+
+unsigned long TriggerBus_getPostedCount(void);
+unsigned long TriggerBus_getOverflowCount(triggerSource_t source);
+
+#endif